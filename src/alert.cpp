@@ -0,0 +1,229 @@
+/*
+ * Author: Elijah Mullens
+ * Date: 09/07/2024
+ */
+
+#include "alert.hpp"
+#include "loglevel.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+/**
+ * splits spec on its first three colons, the text may hold more
+ */
+static std::vector<std::string> split_rule(const std::string &spec) {
+  std::vector<std::string> parts;
+  size_t start = 0;
+  while (parts.size() < 3) {
+    size_t colon = spec.find(':', start);
+    if (colon == std::string::npos) {
+      break;
+    }
+    parts.push_back(spec.substr(start, colon - start));
+    start = colon + 1;
+  }
+  parts.push_back(spec.substr(start));
+  return parts;
+}
+
+/**
+ * the text of spec, empty if it has none
+ */
+static std::string rule_text(const std::string &spec) {
+  std::vector<std::string> parts = split_rule(spec);
+  return parts.size() == 4 ? parts[3] : "";
+}
+
+static uint32_t parse_levels(const std::string &spec,
+                             const std::string &names) {
+  if (names == "*") {
+    return ~0u;
+  }
+  uint32_t levels = 0;
+  size_t start = 0;
+  while (start <= names.size()) {
+    size_t end = std::min(names.find(',', start), names.size());
+    std::string name = names.substr(start, end - start);
+    size_t level = HEADER + 1;
+    while (level < LOG_LEVELS && name != LEVELS[level].name) {
+      level++;
+    }
+    if (level == LOG_LEVELS) {
+      fprintf(stderr, "unknown level %s in alert %s\n", name.c_str(),
+              spec.c_str());
+      exit(EXIT_FAILURE);
+    }
+    levels |= 1u << level;
+    start = end + 1;
+  }
+  return levels;
+}
+
+AlertRules::rule_t::rule_t(const std::string &spec)
+    : text(rule_text(spec)), searcher(text.begin(), text.end()), head(0),
+      slices{}, count(0), quiet_until(0) {
+  std::vector<std::string> parts = split_rule(spec);
+  if (parts.size() < 3 || parts[0].empty()) {
+    fprintf(stderr, "alert %s isn't name:levels:count/seconds[:text]\n",
+            spec.c_str());
+    exit(EXIT_FAILURE);
+  }
+  name = parts[0];
+  levels = parse_levels(spec, parts[1]);
+
+  char *end;
+  errno = 0;
+  threshold = strtoull(parts[2].c_str(), &end, 10);
+  double seconds = *end == '/' ? strtod(end + 1, &end) : 0;
+  if (errno != 0 || threshold == 0 || seconds <= 0 || *end != '\0') {
+    fprintf(stderr, "alert %s needs a threshold/window like 5/10\n",
+            spec.c_str());
+    exit(EXIT_FAILURE);
+  }
+  window = seconds * 1000000000;
+  slice_len = std::max(window / ALERT_SLICES, (uint64_t)1);
+}
+
+AlertRules::AlertRules(const std::vector<std::string> &specs,
+                       const std::string &exec, const std::string &fifo)
+    : exec(exec), fifo(fifo), fifo_fd(-1), running(0) {
+  for (const std::string &spec : specs) {
+    rules.emplace_back(spec);
+  }
+
+  if (!fifo.empty() && mkfifo(fifo.c_str(), 0600) < 0 && errno != EEXIST) {
+    perror("couldn't create alert fifo");
+    exit(EXIT_FAILURE);
+  }
+  struct stat st;
+  if (!fifo.empty() &&
+      (stat(fifo.c_str(), &st) < 0 || !S_ISFIFO(st.st_mode))) {
+    fprintf(stderr, "%s isn't a fifo\n", fifo.c_str());
+    exit(EXIT_FAILURE);
+  }
+}
+
+bool AlertRules::enabled() const { return !rules.empty(); }
+
+void AlertRules::apply(const LogRecord &record) {
+  if (record.level >= LOG_LEVELS) {
+    return;
+  }
+  for (rule_t &rule : rules) {
+    if (!(rule.levels & (1u << record.level))) {
+      continue;
+    }
+    if (!rule.text.empty() &&
+        std::search(record.message.begin(), record.message.end(),
+                    rule.searcher) == record.message.end()) {
+      continue;
+    }
+
+    // slide the window up to this record's slice, a record from an earlier
+    // slice (the clock stepped back) counts in the current one
+    uint64_t slice = record.time / rule.slice_len;
+    if (slice > rule.head) {
+      uint64_t expired = std::min(slice - rule.head, (uint64_t)ALERT_SLICES);
+      for (uint64_t i = 1; i <= expired; i++) {
+        uint32_t &old = rule.slices[(rule.head + i) % ALERT_SLICES];
+        rule.count -= old;
+        old = 0;
+      }
+      rule.head = slice;
+    }
+    rule.slices[rule.head % ALERT_SLICES]++;
+    rule.count++;
+
+    if (rule.count >= rule.threshold && record.time >= rule.quiet_until) {
+      rule.quiet_until = record.time + rule.window;
+      fire(rule, record);
+    }
+  }
+}
+
+void AlertRules::fire(rule_t &rule, const LogRecord &record) {
+  // reap hooks that have finished since the last alert
+  while (running > 0 && waitpid(-1, NULL, WNOHANG) > 0) {
+    running--;
+  }
+
+  std::string message = record.message;
+  std::replace(message.begin(), message.end(), '\n', ' ');
+  std::string line = std::to_string(record.time / 1000000000ull) + " " +
+                     rule.name + " " + std::to_string(rule.count) + " " +
+                     LEVELS[record.level].name + " " + record.source + ": " +
+                     message + "\n";
+
+  if (!exec.empty()) {
+    runExec(rule, record);
+  }
+  if (!fifo.empty()) {
+    writeFifo(line);
+  }
+  if (exec.empty() && fifo.empty()) {
+    fputs(line.c_str(), stderr);
+  }
+}
+
+void AlertRules::runExec(const rule_t &rule, const LogRecord &record) {
+  std::vector<std::string> vars = {
+      "ALERT_NAME=" + rule.name,
+      "ALERT_COUNT=" + std::to_string(rule.count),
+      "ALERT_WINDOW=" + std::to_string(rule.window / 1000000) + "ms",
+      "ALERT_TIME=" + std::to_string(record.time),
+      "ALERT_LEVEL=" + std::string(LEVELS[record.level].name),
+      "ALERT_SOURCE=" + record.source,
+      "ALERT_MESSAGE=" + record.message};
+  std::vector<char *> env;
+  for (char **var = environ; *var != nullptr; var++) {
+    if (strncmp(*var, "ALERT_", 6) != 0) {
+      env.push_back(*var);
+    }
+  }
+  for (std::string &var : vars) {
+    env.push_back(&var[0]);
+  }
+  env.push_back(nullptr);
+
+  const char *argv[] = {"/bin/sh", "-c", exec.c_str(), nullptr};
+  pid_t pid;
+  int err = posix_spawn(&pid, "/bin/sh", NULL, NULL, (char *const *)argv,
+                        env.data());
+  if (err != 0) {
+    fprintf(stderr, "couldn't run alert hook: %s\n", strerror(err));
+    return;
+  }
+  running++;
+}
+
+void AlertRules::writeFifo(const std::string &line) {
+  // opened lazily and without blocking, so a FIFO nobody reads just drops
+  // the alert
+  if (fifo_fd < 0 &&
+      (fifo_fd = open(fifo.c_str(), O_WRONLY | O_NONBLOCK)) < 0) {
+    return;
+  }
+  if (write(fifo_fd, line.data(), line.size()) != (ssize_t)line.size() &&
+      errno == EPIPE) {
+    // the reader went away, open again for the next one
+    close(fifo_fd);
+    fifo_fd = -1;
+  }
+}
+
+AlertRules::~AlertRules() {
+  if (fifo_fd >= 0) {
+    close(fifo_fd);
+  }
+}
@@ -0,0 +1,92 @@
+#ifndef _ALERT_H
+#define _ALERT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "logrecord.hpp"
+
+// slices each rule's window is counted in, the window slides a slice at a
+// time
+#define ALERT_SLICES 10
+
+/**
+ * rules evaluated on every record as it is committed, each fires a hook once
+ * enough matching records arrive within its window
+ *
+ * a rule is name:levels:count/seconds[:text], e.g.
+ * disk:error,fatal:5/10:disk full fires when 5 error or fatal records whose
+ * message contains "disk full" arrive within 10 seconds, * matches every
+ * level and without text every message matches
+ *
+ * the level test comes first and is one bit test, only then is the message
+ * searched, with a Boyer-Moore-Horspool table built once per rule. the
+ * window is a ring of ALERT_SLICES counters with a running sum, so a record
+ * costs O(1) per rule. a rule that fired stays quiet for one window
+ *
+ * firing runs the exec command through /bin/sh with the ALERT_* variables
+ * set, without waiting for it, and/or writes a line to a FIFO, dropped if
+ * nothing is reading. with neither, the line goes to stderr
+ */
+class AlertRules {
+public:
+  /**
+   * exits if a rule doesn't parse, fifo is created if it doesn't exist
+   */
+  AlertRules(const std::vector<std::string> &rules, const std::string &exec,
+             const std::string &fifo);
+
+  bool enabled() const;
+
+  /**
+   * counts record against every rule, firing those that reach their
+   * threshold, queue thread only
+   */
+  void apply(const LogRecord &record);
+
+  ~AlertRules();
+
+private:
+  typedef std::boyer_moore_horspool_searcher<std::string::const_iterator>
+      searcher_t;
+
+  struct rule_t {
+    std::string name;
+    // bit 1 << level for every level the rule counts
+    uint32_t levels;
+    uint64_t threshold;
+    uint64_t window;
+    std::string text;
+    searcher_t searcher;
+
+    // slice counts, the one time / slice_len % ALERT_SLICES is current
+    uint64_t slice_len;
+    uint64_t head;
+    uint32_t slices[ALERT_SLICES];
+    uint64_t count;
+    // no firing before this time, nanoseconds since the epoch
+    uint64_t quiet_until;
+
+    rule_t(const std::string &spec);
+  };
+
+  // a deque so rules never move, their searchers point into their text
+  std::deque<rule_t> rules;
+  std::string exec;
+  std::string fifo;
+  int fifo_fd;
+  // hooks that haven't been reaped yet
+  size_t running;
+
+  void fire(rule_t &rule, const LogRecord &record);
+
+  void runExec(const rule_t &rule, const LogRecord &record);
+
+  void writeFifo(const std::string &line);
+};
+
+#endif // _ALERT_H
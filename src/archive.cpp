@@ -0,0 +1,699 @@
+/*
+ * Author: Elijah Mullens
+ * Date: 09/07/2024
+ */
+
+#include "archive.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/ioprio.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static void put_varint(std::string &out, uint64_t v) {
+  while (v >= 0x80) {
+    out += (char)(v | 0x80);
+    v >>= 7;
+  }
+  out += (char)v;
+}
+
+static void put_string(std::string &out, const std::string &s) {
+  put_varint(out, s.size());
+  out += s;
+}
+
+/**
+ * whether message is its tokens joined by single spaces, i.e. whether
+ * expand_template can rebuild it exactly
+ */
+static bool single_spaced(const std::string &message) {
+  if (!message.empty() && (message.front() == ' ' || message.back() == ' ')) {
+    return false;
+  }
+  for (size_t i = 0; i < message.size(); i++) {
+    char c = message[i];
+    if (c == '\t' || c == '\n' || c == '\r' ||
+        (c == ' ' && message[i + 1] == ' ')) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * the two filter bits of a trigram, its first byte lowest, as bits of a
+ * FILTER_BITS_MAX filter, a folded filter of n bits uses their low bits
+ */
+static void trigram_bits(uint32_t trigram, uint32_t bits[2]) {
+  uint64_t h = trigram * 0x9e3779b97f4a7c15ull;
+  bits[0] = h >> 46;
+  bits[1] = (h >> 28) & (FILTER_BITS_MAX - 1);
+}
+
+static size_t popcount(const uint64_t *words, size_t n) {
+  size_t set = 0;
+  for (size_t i = 0; i < n; i++) {
+    set += __builtin_popcountll(words[i]);
+  }
+  return set;
+}
+
+/**
+ * returns false if the varint runs past end
+ */
+static bool get_varint(const char *&p, const char *end, uint64_t &v) {
+  v = 0;
+  for (int shift = 0; p < end && shift < 64; shift += 7) {
+    uint8_t byte = *p++;
+    v |= (uint64_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool get_string(const char *&p, const char *end, std::string &s) {
+  uint64_t len;
+  if (!get_varint(p, end, len) || len > (uint64_t)(end - p)) {
+    return false;
+  }
+  s.assign(p, len);
+  p += len;
+  return true;
+}
+
+ArchiveWriter::ArchiveWriter(const std::string &name, TemplateMiner &miner,
+                             bool compress, bool recompress)
+    : file(-1), miner(miner), header{}, last_time(0),
+      compressor(!name.empty() && compress), dictionary(0),
+      recompressor(!name.empty() && recompress) {
+  if (name.empty()) {
+    return;
+  }
+  if (name == "stdout") {
+    fprintf(stderr, "archives need a log file\n");
+    exit(EXIT_FAILURE);
+  }
+
+  path = name + ARCHIVE_SUFFIX;
+  filter.resize(FILTER_BITS_MAX / 64);
+  open();
+}
+
+void ArchiveWriter::open() {
+  if ((file = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0) {
+    perror("couldn't open archive");
+    exit(EXIT_FAILURE);
+  }
+
+  struct stat st;
+  if (fstat(file, &st) == 0 && st.st_size == 0) {
+    if (write(file, ARCHIVE_MAGIC, ARCHIVE_MAGIC_LEN) != ARCHIVE_MAGIC_LEN) {
+      perror("couldn't write archive");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+bool ArchiveWriter::enabled() const { return file >= 0; }
+
+void ArchiveWriter::add(const LogRecord &record) {
+  // a template only keeps single spaces between tokens, a message spaced any
+  // other way, e.g. a multi-line stack trace, is stored whole
+  uint32_t template_id =
+      record.template_id != 0 && single_spaced(record.message)
+          ? record.template_id
+          : 0;
+  // looked up now, the template may be generalised under a new id later
+  if (template_id != 0 &&
+      chunk_templates.find(template_id) == chunk_templates.end()) {
+    chunk_templates.emplace(template_id, miner.text(template_id));
+  }
+
+  if (header.count == 0) {
+    header.kind = RECORDS;
+    header.flags = ARCHIVE_TRACED;
+    header.min_time = record.time;
+    header.max_time = record.time;
+    last_time = 0;
+  }
+  header.min_time = std::min(header.min_time, record.time);
+  header.max_time = std::max(header.max_time, record.time);
+  header.levels |= 1u << record.level;
+  header.count++;
+
+  int64_t delta = record.time - last_time;
+  last_time = record.time;
+  body += (char)record.level;
+  put_varint(body, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+  put_varint(body, record.pid);
+  put_string(body, record.source);
+  put_string(body, record.fields);
+  put_varint(body, template_id);
+  put_string(body, template_id != 0 ? record.params : record.message);
+  add_trigrams(template_id != 0 ? record.params : record.message);
+  bool traced = id_is_set(record.trace.trace_id, TRACE_ID_LEN) ||
+                id_is_set(record.trace.span_id, SPAN_ID_LEN);
+  body += (char)traced;
+  if (traced) {
+    body.append((const char *)&record.trace, sizeof(record.trace));
+  }
+}
+
+void ArchiveWriter::add_trigrams(const std::string &s) {
+  // rolled a byte at a time, the stores can't be taken to overwrite s
+  uint64_t *words = filter.data();
+  uint32_t trigram = 0;
+  uint32_t bits[2];
+  for (size_t i = 0; i < s.size(); i++) {
+    trigram = trigram >> 8 | (uint32_t)(uint8_t)s[i] << 16;
+    if (i >= 2) {
+      trigram_bits(trigram, bits);
+      words[bits[0] / 64] |= 1ull << (bits[0] % 64);
+      words[bits[1] / 64] |= 1ull << (bits[1] % 64);
+    }
+  }
+}
+
+void ArchiveWriter::flush() {
+  if (!enabled() || header.count == 0) {
+    return;
+  }
+
+  // the templates and the records that use them go out in one write, so a
+  // crash can't leave records behind without their dictionary
+  std::string templates;
+  archive_header_t dict = {};
+  dict.kind = TEMPLATES;
+  for (auto &entry : chunk_templates) {
+    if (written.insert(entry.first).second) {
+      put_varint(templates, entry.first);
+      put_string(templates, entry.second);
+      dict.count++;
+    }
+  }
+  dict.len = templates.size();
+
+  std::shared_ptr<const dictionary_t> zdict;
+  std::string *payload = &body;
+  if (compressor.enabled() && compressor.compress(body, packed, zdict)) {
+    header.codec = ZSTD;
+    payload = &packed;
+  }
+  header.len = payload->size();
+
+  // a new zstd dictionary goes out once per file, ahead of its first use
+  archive_header_t zheader = {};
+  if (zdict && zdict->id != dictionary) {
+    zheader.kind = DICTIONARY;
+    zheader.len = zdict->content.size();
+    dictionary = zdict->id;
+  }
+
+  // folded while that leaves at most half the bits set, a filter already
+  // fuller than that would rule out too little to be worth its bytes
+  std::string ids;
+  archive_header_t fheader = {};
+  size_t words = filter.size();
+  if (popcount(filter.data(), words) * 2 <= words * 64) {
+    while (words * 64 > FILTER_BITS_MIN) {
+      size_t half = words / 2;
+      size_t set = 0;
+      for (size_t i = 0; i < half; i++) {
+        set += __builtin_popcountll(filter[i] | filter[i + half]);
+      }
+      if (set * 2 > half * 64) {
+        break;
+      }
+      for (size_t i = 0; i < half; i++) {
+        filter[i] |= filter[i + half];
+      }
+      words = half;
+    }
+    fheader.kind = FILTER;
+    for (auto &entry : chunk_templates) {
+      put_varint(ids, entry.first);
+      fheader.count++;
+    }
+    fheader.len = ids.size() + words * sizeof(uint64_t);
+  }
+
+  struct iovec iov[9];
+  int n = 0;
+  if (dict.count > 0) {
+    iov[n++] = {&dict, sizeof(dict)};
+    iov[n++] = {&templates[0], templates.size()};
+  }
+  if (zheader.kind == DICTIONARY) {
+    iov[n++] = {&zheader, sizeof(zheader)};
+    iov[n++] = {(void *)zdict->content.data(), zdict->content.size()};
+  }
+  if (fheader.kind == FILTER) {
+    iov[n++] = {&fheader, sizeof(fheader)};
+    iov[n++] = {&ids[0], ids.size()};
+    iov[n++] = {filter.data(), words * sizeof(uint64_t)};
+  }
+  iov[n++] = {&header, sizeof(header)};
+  iov[n++] = {&(*payload)[0], payload->size()};
+
+  size_t total = 0;
+  for (int i = 0; i < n; i++) {
+    total += iov[i].iov_len;
+  }
+  ssize_t bytes;
+  while ((bytes = writev(file, iov, n)) < 0 && errno == EINTR) {
+  }
+  if (bytes != (ssize_t)total) {
+    perror("couldn't write archive");
+  }
+
+  header = {};
+  body.clear();
+  chunk_templates.clear();
+  std::fill(filter.begin(), filter.end(), 0);
+}
+
+void ArchiveWriter::rotate(const std::string &rotated) {
+  if (!enabled()) {
+    return;
+  }
+
+  close(file);
+  if (rename(path.c_str(), (rotated + ARCHIVE_SUFFIX).c_str()) < 0) {
+    perror("couldn't rotate archive");
+  } else if (recompressor.enabled()) {
+    recompressor.add(rotated + ARCHIVE_SUFFIX);
+  }
+
+  written.clear();
+  dictionary = 0;
+  open();
+}
+
+ArchiveWriter::~ArchiveWriter() {
+  if (enabled()) {
+    flush();
+    close(file);
+  }
+}
+
+bool recompress_archive(const std::string &path,
+                        const std::atomic<bool> &stop) {
+  FILE *in = fopen(path.c_str(), "r");
+  if (in == nullptr) {
+    return false;
+  }
+  char magic[ARCHIVE_MAGIC_LEN];
+  if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+      memcmp(magic, ARCHIVE_MAGIC, sizeof(magic)) != 0) {
+    fclose(in);
+    return false;
+  }
+
+  // every chunk in order with records decompressed, the old dictionaries are
+  // only needed to do that
+  std::vector<std::pair<archive_header_t, std::string>> chunks;
+  Decompressor decompressor;
+  size_t records_len = 0;
+  bool ok = true;
+  archive_header_t header;
+  while (ok && fread(&header, sizeof(header), 1, in) == 1) {
+    std::string body(header.len, '\0');
+    if (fread(&body[0], 1, header.len, in) != header.len) {
+      break;
+    }
+    if (header.kind == DICTIONARY) {
+      decompressor.add(body);
+      continue;
+    }
+    if (header.kind == RECORDS) {
+      if (header.codec == ZSTD) {
+        std::string plain;
+        ok = decompressor.decompress(body, plain);
+        body.swap(plain);
+        header.codec = PLAIN;
+      }
+      records_len += body.size();
+    }
+    chunks.emplace_back(header, std::move(body));
+  }
+  fclose(in);
+  if (!ok || stop) {
+    return false;
+  }
+
+  // a dictionary only pays off for archives of many chunks, trained on a
+  // sample spread over the whole archive
+  std::shared_ptr<const dictionary_t> dict;
+  if (records_len >= COMPRESS_SAMPLE_SIZE) {
+    std::vector<std::string> samples;
+    size_t stride = records_len / COMPRESS_COLD_SAMPLE + 1;
+    size_t seen = 0;
+    for (auto &chunk : chunks) {
+      if (chunk.first.kind == RECORDS && seen++ % stride == 0) {
+        samples.push_back(chunk.second);
+      }
+    }
+    dict = train_dictionary(samples, COMPRESS_COLD_LEVEL);
+  }
+
+  std::string tmp = path + ".tmp";
+  FILE *out = fopen(tmp.c_str(), "w");
+  if (out == nullptr) {
+    return false;
+  }
+  fwrite(ARCHIVE_MAGIC, 1, ARCHIVE_MAGIC_LEN, out);
+  bool dict_written = false;
+  std::string packed;
+  for (auto &chunk : chunks) {
+    if (stop) {
+      ok = false;
+      break;
+    }
+
+    archive_header_t &header = chunk.first;
+    const std::string *body = &chunk.second;
+    if (header.kind == RECORDS) {
+      if (dict && !dict_written) {
+        archive_header_t zheader = {};
+        zheader.kind = DICTIONARY;
+        zheader.len = dict->content.size();
+        fwrite(&zheader, sizeof(zheader), 1, out);
+        fwrite(dict->content.data(), 1, dict->content.size(), out);
+        dict_written = true;
+      }
+      if (compress_chunk(*body, packed, dict.get(), COMPRESS_COLD_LEVEL)) {
+        header.codec = ZSTD;
+        body = &packed;
+      }
+      header.len = body->size();
+    }
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(body->data(), 1, body->size(), out);
+  }
+
+  ok = ok && fflush(out) == 0 && !ferror(out) && fdatasync(fileno(out)) == 0;
+  fclose(out);
+  // retention may have deleted the archive meanwhile
+  if (!ok || access(path.c_str(), F_OK) < 0 ||
+      rename(tmp.c_str(), path.c_str()) < 0) {
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+Recompressor::Recompressor(bool enabled) : on(enabled), stopping(false) {
+  if (!on) {
+    return;
+  }
+#ifdef HAVE_ZSTD
+  worker = std::thread(&Recompressor::run, this);
+#else
+  fprintf(stderr, "recompression needs a build with zstd\n");
+  exit(EXIT_FAILURE);
+#endif
+}
+
+bool Recompressor::enabled() const { return on; }
+
+void Recompressor::add(const std::string &path) {
+  std::lock_guard<std::mutex> guard(lock);
+  queue.push_back(path);
+  queued.notify_all();
+}
+
+void Recompressor::run() {
+  // only this thread, the rest of the process keeps its priority
+  pid_t tid = syscall(SYS_gettid);
+  if (setpriority(PRIO_PROCESS, tid, RECOMPRESS_NICE) < 0) {
+    perror("couldn't lower recompression cpu priority");
+  }
+  if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid,
+              IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0)) < 0) {
+    perror("couldn't lower recompression io priority");
+  }
+
+  std::unique_lock<std::mutex> guard(lock);
+  while (true) {
+    queued.wait(guard, [this] { return stopping || !queue.empty(); });
+    if (stopping) {
+      return;
+    }
+
+    std::string path = queue.front();
+    queue.pop_front();
+    guard.unlock();
+    if (!recompress_archive(path, stopping) && !stopping &&
+        access(path.c_str(), F_OK) == 0) {
+      fprintf(stderr, "couldn't recompress %s\n", path.c_str());
+    }
+    guard.lock();
+  }
+}
+
+Recompressor::~Recompressor() {
+  if (!on) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+    queued.notify_all();
+  }
+  worker.join();
+}
+
+ArchiveReader::ArchiveReader() : file(nullptr), current{}, current_offset(0) {}
+
+bool ArchiveReader::open(const std::string &path) {
+  if ((file = fopen(path.c_str(), "r")) == nullptr) {
+    return false;
+  }
+
+  char magic[ARCHIVE_MAGIC_LEN];
+  return fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+         memcmp(magic, ARCHIVE_MAGIC, sizeof(magic)) == 0;
+}
+
+bool ArchiveReader::next(archive_header_t &header) {
+  if (current.kind == RECORDS) {
+    if (fseeko(file, current.len, SEEK_CUR) < 0) {
+      return false;
+    }
+  }
+  current = {};
+  filter_templates.clear();
+  filter.clear();
+
+  std::string body;
+  while (fread(&header, sizeof(header), 1, file) == 1) {
+    if (header.kind == RECORDS) {
+      current = header;
+      current_offset = ftello(file);
+      return true;
+    }
+    body.resize(header.len);
+    if ((header.kind != TEMPLATES && header.kind != DICTIONARY &&
+         header.kind != FILTER) ||
+        fread(&body[0], 1, header.len, file) != header.len) {
+      return false;
+    }
+    if (header.kind == DICTIONARY) {
+      decompressor.add(body);
+      continue;
+    }
+
+    const char *p = body.data();
+    const char *end = p + body.size();
+    if (header.kind == FILTER) {
+      for (uint32_t i = 0; i < header.count; i++) {
+        uint64_t id;
+        if (!get_varint(p, end, id)) {
+          return false;
+        }
+        filter_templates.push_back(id);
+      }
+      filter.assign(p, end);
+      continue;
+    }
+    for (uint32_t i = 0; i < header.count; i++) {
+      uint64_t id;
+      std::string text;
+      if (!get_varint(p, end, id) || !get_string(p, end, text)) {
+        return false;
+      }
+      dictionary[id] = text;
+    }
+  }
+  return false;
+}
+
+off_t ArchiveReader::offset() const { return current_offset; }
+
+bool ArchiveReader::may_contain(const std::string &needle) const {
+  size_t words = filter.size() / sizeof(uint64_t);
+  if (words == 0 || (words & (words - 1)) != 0) {
+    return true;
+  }
+
+  // each space separated piece of needle lies within one token of a message,
+  // either literal text of a template or a param or message stored whole,
+  // whose trigrams are all in the filter
+  size_t start = 0;
+  while (start < needle.size()) {
+    size_t end = std::min(needle.find(' ', start), needle.size());
+    std::string piece = needle.substr(start, end - start);
+    start = end + 1;
+    if (piece.size() < 3) {
+      continue;
+    }
+    bool literal = false;
+    for (uint32_t id : filter_templates) {
+      if (literal_match(text(id), piece)) {
+        literal = true;
+        break;
+      }
+    }
+    if (literal) {
+      continue;
+    }
+
+    uint32_t mask = words * 64 - 1;
+    uint32_t bits[2];
+    for (size_t i = 0; i + 3 <= piece.size(); i++) {
+      trigram_bits((uint8_t)piece[i] | (uint8_t)piece[i + 1] << 8 |
+                       (uint8_t)piece[i + 2] << 16,
+                   bits);
+      for (uint32_t bit : bits) {
+        bit &= mask;
+        uint64_t word;
+        memcpy(&word, &filter[bit / 64 * sizeof(word)], sizeof(word));
+        if ((word & (1ull << (bit % 64))) == 0) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+bool ArchiveReader::records(off_t offset, const archive_header_t &header,
+                            std::vector<LogRecord> &out) const {
+  out.clear();
+  std::string body(header.len, '\0');
+  if (pread(fileno(file), &body[0], header.len, offset) !=
+      (ssize_t)header.len) {
+    return false;
+  }
+  if (header.codec == ZSTD) {
+    std::string packed;
+    packed.swap(body);
+    if (!decompressor.decompress(packed, body)) {
+      return false;
+    }
+  } else if (header.codec != PLAIN) {
+    return false;
+  }
+
+  const char *p = body.data();
+  const char *end = p + body.size();
+  uint64_t time = 0;
+  for (uint32_t i = 0; i < header.count; i++) {
+    LogRecord record = {};
+    uint64_t delta, pid, id;
+    if (p == end) {
+      return false;
+    }
+    record.level = *p++;
+    if (!get_varint(p, end, delta) || !get_varint(p, end, pid) ||
+        !get_string(p, end, record.source) ||
+        !get_string(p, end, record.fields) || !get_varint(p, end, id) ||
+        !get_string(p, end, record.params)) {
+      return false;
+    }
+    if (header.flags & ARCHIVE_TRACED) {
+      if (p == end) {
+        return false;
+      }
+      if (*p++ != 0) {
+        if ((size_t)(end - p) < sizeof(record.trace)) {
+          return false;
+        }
+        memcpy(&record.trace, p, sizeof(record.trace));
+        p += sizeof(record.trace);
+      }
+    }
+
+    time += (int64_t)(delta >> 1) ^ -(int64_t)(delta & 1);
+    record.time = time;
+    record.pid = pid;
+    record.template_id = id;
+    if (id == 0) {
+      record.message.swap(record.params);
+    }
+    out.push_back(std::move(record));
+  }
+  return true;
+}
+
+const std::string &ArchiveReader::text(uint32_t id) const {
+  static const std::string none;
+  auto found = dictionary.find(id);
+  return found == dictionary.end() ? none : found->second;
+}
+
+ArchiveReader::~ArchiveReader() {
+  if (file != nullptr) {
+    fclose(file);
+  }
+}
+
+std::string expand_template(const std::string &text,
+                            const std::string &params) {
+  std::string message;
+  size_t param = 0;
+  size_t start = 0;
+  while (start <= text.size()) {
+    size_t end = text.find(' ', start);
+    if (end == std::string::npos) {
+      end = text.size();
+    }
+
+    if (start > 0) {
+      message += ' ';
+    }
+    if (text.compare(start, end - start, WILDCARD) == 0) {
+      size_t stop = params.find(' ', param);
+      if (stop == std::string::npos) {
+        stop = params.size();
+      }
+      message.append(params, param, stop - param);
+      param = std::min(stop + 1, params.size());
+    } else {
+      message.append(text, start, end - start);
+    }
+    start = end + 1;
+  }
+  return message;
+}
+
+bool literal_match(const std::string &text, const std::string &needle) {
+  for (size_t pos = text.find(needle); pos != std::string::npos;
+       pos = text.find(needle, pos + 1)) {
+    size_t wildcard = text.find(WILDCARD, pos >= 2 ? pos - 2 : 0);
+    if (wildcard == std::string::npos || wildcard >= pos + needle.size()) {
+      return true;
+    }
+  }
+  return false;
+}
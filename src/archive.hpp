@@ -0,0 +1,267 @@
+#ifndef _ARCHIVE_H
+#define _ARCHIVE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "compress.hpp"
+#include "drain.hpp"
+#include "logrecord.hpp"
+
+#define ARCHIVE_MAGIC "LOGARC1\n"
+#define ARCHIVE_MAGIC_LEN 8
+#define ARCHIVE_SUFFIX ".arc"
+// chunk bytes of a closed archive its cold dictionary is trained on
+#define COMPRESS_COLD_SAMPLE (8 * 1024 * 1024)
+// nice value of the recompression thread
+#define RECOMPRESS_NICE 19
+// bits of the trigram filter a records chunk starts with, it's folded in half
+// while no more than half of the bits are set, down to FILTER_BITS_MIN
+#define FILTER_BITS_MAX (1 << 18)
+#define FILTER_BITS_MIN 512
+
+/**
+ * an archive is ARCHIVE_MAGIC followed by chunks, each an archive_header_t and
+ * len bytes of body
+ * - TEMPLATES  :- count (varint id, varint length, template) entries, written
+ *                 before the first records chunk that uses them
+ * - DICTIONARY :- a zstd dictionary, written before the first records chunk
+ *                 compressed with it
+ * - FILTER    :- count varint ids of the templates the next records chunk
+ *                uses, then a bloom filter of the trigrams of its params and
+ *                of its messages stored whole, two bits per trigram. written
+ *                only while at most half of FILTER_BITS_MAX bits are set
+ * - RECORDS   :- count records of (level, zigzag varint time delta, varint
+ *                pid, source, fields, varint template id, params), strings
+ *                as varint length and bytes, the message is only stored
+ *                when the template id is 0 and then takes the place of params.
+ *                with ARCHIVE_TRACED each record ends in a byte, 1 if the
+ *                trace_context_t follows, with codec ZSTD the body is a zstd
+ *                frame of all of that
+ *
+ * the header of a records chunk carries its time range and the levels in it,
+ * so a search can skip the chunk without reading its body, and its filter
+ * lets a text search skip it too. a chunk holds the records of one batch, so
+ * chunks and the log rotate at the same record
+ */
+enum archive_chunk_t : uint8_t {
+  TEMPLATES = 'T',
+  DICTIONARY = 'D',
+  FILTER = 'F',
+  RECORDS = 'R'
+};
+
+enum archive_codec_t : uint8_t { PLAIN = 0, ZSTD = 1 };
+
+// archive_header_t flags, records written before trace contexts existed
+// have none
+#define ARCHIVE_TRACED 1
+
+struct archive_header_t {
+  uint8_t kind;
+  uint8_t codec;
+  uint8_t flags;
+  uint8_t reserved;
+  // bit 1 << level for every level in the chunk
+  uint32_t levels;
+  uint32_t count;
+  uint32_t len;
+  uint64_t min_time;
+  uint64_t max_time;
+};
+
+static_assert(sizeof(archive_header_t) == 32, "archive header must be packed");
+
+/**
+ * rewrites the sealed archive at path with its records chunks compressed at
+ * COMPRESS_COLD_LEVEL with a dictionary trained on the whole archive, the new
+ * archive is renamed over path so readers see either one or the other
+ *
+ * returns false, leaving path as it was, if it can't be read or stop is set
+ * part way through
+ */
+bool recompress_archive(const std::string &path, const std::atomic<bool> &stop);
+
+/**
+ * recompresses sealed archives handed to it one at a time on a thread with
+ * idle cpu and io priority, so it only uses what ingest leaves over
+ */
+class Recompressor {
+public:
+  /**
+   * recompression is off unless enabled, which exits if built without zstd
+   */
+  Recompressor(bool enabled);
+
+  bool enabled() const;
+
+  /**
+   * queues the sealed archive at path
+   */
+  void add(const std::string &path);
+
+  ~Recompressor();
+
+private:
+  bool on;
+  std::thread worker;
+  std::mutex lock;
+  std::condition_variable queued;
+  std::deque<std::string> queue;
+  std::atomic<bool> stopping;
+
+  /**
+   * body of the worker thread
+   */
+  void run();
+};
+
+/**
+ * writes records alongside the log as <name>.arc, which is sealed into
+ * <segment>.arc whenever the log rotates
+ */
+class ArchiveWriter {
+public:
+  /**
+   * archiving is off if name is empty, template ids are looked up in miner,
+   * chunks are compressed if compress is set and sealed archives recompressed
+   * if recompress is
+   */
+  ArchiveWriter(const std::string &name, TemplateMiner &miner, bool compress,
+                bool recompress);
+
+  bool enabled() const;
+
+  void add(const LogRecord &record);
+
+  /**
+   * writes the open chunk, called once its records' batch has been appended
+   * to the log
+   */
+  void flush();
+
+  /**
+   * seals the archive as rotated + ARCHIVE_SUFFIX, queues it for
+   * recompression and starts a new one, the open chunk holds the batch being
+   * appended so it goes to the new archive
+   */
+  void rotate(const std::string &rotated);
+
+  ~ArchiveWriter();
+
+private:
+  std::string path;
+  ssize_t file;
+  TemplateMiner &miner;
+
+  archive_header_t header;
+  std::string body;
+  uint64_t last_time;
+
+  // templates used by the open chunk and the ids already in the file
+  std::unordered_map<uint32_t, std::string> chunk_templates;
+  std::unordered_set<uint32_t> written;
+  // FILTER_BITS_MAX bits of the open chunk's trigram filter
+  std::vector<uint64_t> filter;
+
+  Compressor compressor;
+  std::string packed;
+  // id of the last dictionary written to the file, 0 if none
+  uint32_t dictionary;
+  Recompressor recompressor;
+
+  void open();
+
+  /**
+   * sets the filter bits of every trigram of s
+   */
+  void add_trigrams(const std::string &s);
+};
+
+/**
+ * reads an archive chunk by chunk, templates and dictionary chunks are
+ * absorbed as they go by
+ */
+class ArchiveReader {
+public:
+  ArchiveReader();
+
+  /**
+   * returns false if path can't be opened or isn't an archive
+   */
+  bool open(const std::string &path);
+
+  /**
+   * moves to the next records chunk and fills in its header, the body is
+   * skipped over and only read by records
+   *
+   * returns false at the end of the archive, a chunk cut short by a crash
+   * ends it
+   */
+  bool next(archive_header_t &header);
+
+  /**
+   * where the body of the chunk next last returned starts
+   */
+  off_t offset() const;
+
+  /**
+   * whether a message of the chunk next last returned may contain needle,
+   * false only if its filter rules it out, so always true without one
+   */
+  bool may_contain(const std::string &needle) const;
+
+  /**
+   * decodes the records of the chunk at offset, the message of a record with
+   * a template is left empty to be rebuilt with expand_template only if it's
+   * needed
+   *
+   * threadsafe once the dictionary holds every template, i.e. after next has
+   * returned false
+   */
+  bool records(off_t offset, const archive_header_t &header,
+               std::vector<LogRecord> &out) const;
+
+  /**
+   * the template with id, empty if the archive doesn't define it
+   */
+  const std::string &text(uint32_t id) const;
+
+  ~ArchiveReader();
+
+private:
+  FILE *file;
+  archive_header_t current;
+  off_t current_offset;
+  // the template ids and filter bits of the current chunk, empty if it has
+  // no filter
+  std::vector<uint32_t> filter_templates;
+  std::string filter;
+  std::unordered_map<uint32_t, std::string> dictionary;
+  Decompressor decompressor;
+};
+
+/**
+ * rebuilds a message from its template and the space separated params that
+ * fill its wildcards
+ */
+std::string expand_template(const std::string &text, const std::string &params);
+
+/**
+ * whether every message of the template contains needle without rebuilding
+ * it, i.e. needle occurs in the template clear of its wildcards
+ */
+bool literal_match(const std::string &text, const std::string &needle);
+
+#endif // _ARCHIVE_H
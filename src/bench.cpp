@@ -0,0 +1,820 @@
+/*
+ * Author: Elijah Mullens
+ * Date: 09/07/2024
+ *
+ * [Description]
+ * Benchmarks for the logger, each prints what it measured and exits.
+ *
+ * - mixed :- starts a logserver, floods it from --firehose clients while
+ *   --probes clients each send --rate logs a second, and reports how long the
+ *   probes' logs took to reach the output, i.e. whether a busy connection
+ *   starves the quiet ones. Latency is taken when a line is read back from
+ *   the output, so the server must write with append or fadvise. With
+ *   --firehose=0 it measures plain ingest latency, e.g. of the socket options
+ * - http :- starts a logserver with --http and has --firehose clients POST
+ *   bodies of --lines records of --size bytes to it, one request at a time
+ *   on a kept alive connection, reporting the records/s accepted and
+ *   checking they all reach the output
+ * - format :- times the timestamp and integer kernels of fastfmt.hpp and a
+ *   whole LineFormat line against the snprintf and strftime they replaced
+ * - redact :- Redactor throughput over typical messages with 0, 10 and 100
+ *   patterns, half of them literal*
+ * - alert :- AlertRules::apply over request logs with 0, 8 and 32 rules,
+ *   levels only and levels plus text, none of which fire
+ * - syslog :- parse_syslog over a mix of RFC 5424 and 3164 messages, alone
+ *   and behind syslog_frame as on a TCP connection
+ * - verify :- writes --megabytes with --checksum=on and times logverify
+ *   checking it, from the page cache and again after evicting it, the
+ *   options after -- go to logverify rather than logserver
+ * - writer :- LogWriter throughput in each write mode, appending --batch
+ *   byte batches of 100 byte lines to --out and flushing after each, as the
+ *   queue thread does when it drains
+ *
+ * [Format]
+ * ./logbench benchmark [options...] [-- logserver options...]
+ *
+ * [Options]
+ * - --server=path :- the logserver to run (default ./logserver)
+ * - --port=port :- port it listens on (default 9797)
+ * - --verifier=path :- the logverify to run (default ./logverify)
+ * - --out=path :- its output, removed before and after (default
+ *   logbench.log)
+ * - --seconds=n :- how long to send for (default 5)
+ * - --http=port :- HTTP port the logserver is given (default 9798)
+ * - --firehose=n :- clients sending as fast as they can (default 1)
+ * - --size=bytes :- length of each firehose message (default 100)
+ * - --lines=n :- records in each HTTP request's body (default 1000)
+ * - --probes=n :- low rate clients (default 8)
+ * - --rate=n :- logs a second each probe sends (default 100)
+ * - --nodelay=on|off, --cork=on|off, --busy-poll=usec :- the probes'
+ *   LogClientOptions (default off, off, 0), the server's --busy-poll goes
+ *   after --
+ * - --records=n :- records formatted, redacted, alerted on or parsed per
+ *   case (default 1000000)
+ * - --megabytes=n :- written per write mode or for logverify (default 256)
+ * - --batch=bytes :- size of each append (default 64KiB)
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "alert.hpp"
+#include "logclient.hpp"
+#include "logformat.hpp"
+#include "logwriter.hpp"
+#include "redact.hpp"
+#include "syslog.hpp"
+
+// what a probe's message starts with, followed by when it was sent
+#define PROBE_TAG "probe "
+
+struct Options {
+  std::string server = "./logserver";
+  std::string verifier = "./logverify";
+  uint16_t port = 9797;
+  std::string out = "logbench.log";
+  size_t seconds = 5;
+  size_t firehose = 1;
+  size_t size = 100;
+  size_t probes = 8;
+  size_t rate = 100;
+  LogClientOptions probe;
+  size_t records = 1000000;
+  size_t megabytes = 256;
+  size_t batch = 64 << 10;
+  uint16_t http = 9798;
+  size_t lines = 1000;
+  // passed through to logserver
+  std::vector<char *> server_options;
+};
+
+size_t get_size(const std::string &key, const std::string &value) {
+  char *end;
+  errno = 0;
+  unsigned long long size = strtoull(value.c_str(), &end, 10);
+  if (errno != 0 || end == value.c_str() || *end != '\0') {
+    fprintf(stderr, "%s must be a number\n", key.c_str());
+    exit(EXIT_FAILURE);
+  }
+  return size;
+}
+
+bool get_switch(const std::string &key, const std::string &value) {
+  if (value == "on") {
+    return true;
+  } else if (value == "off") {
+    return false;
+  }
+  fprintf(stderr, "%s must be on or off\n", key.c_str());
+  exit(EXIT_FAILURE);
+}
+
+void parse_option(Options &options, char *option) {
+  std::string opt(option);
+  size_t eq = opt.find('=');
+  if (opt.rfind("--", 0) != 0 || eq == std::string::npos) {
+    fprintf(stderr, "invalid option %s\n", option);
+    exit(EXIT_FAILURE);
+  }
+
+  std::string key = opt.substr(2, eq - 2);
+  std::string value = opt.substr(eq + 1);
+
+  if (key == "server") {
+    options.server = value;
+  } else if (key == "verifier") {
+    options.verifier = value;
+  } else if (key == "port") {
+    size_t port = get_size(key, value);
+    if (port == 0 || port > UINT16_MAX) {
+      fprintf(stderr, "port must be 1 to 65535\n");
+      exit(EXIT_FAILURE);
+    }
+    options.port = port;
+  } else if (key == "http") {
+    size_t port = get_size(key, value);
+    if (port == 0 || port > UINT16_MAX) {
+      fprintf(stderr, "http must be 1 to 65535\n");
+      exit(EXIT_FAILURE);
+    }
+    options.http = port;
+  } else if (key == "lines") {
+    options.lines = std::max<size_t>(get_size(key, value), 1);
+  } else if (key == "out") {
+    options.out = value;
+  } else if (key == "seconds") {
+    options.seconds = get_size(key, value);
+  } else if (key == "firehose") {
+    options.firehose = get_size(key, value);
+  } else if (key == "size") {
+    options.size = get_size(key, value);
+  } else if (key == "probes") {
+    options.probes = get_size(key, value);
+  } else if (key == "rate") {
+    options.rate = std::max<size_t>(get_size(key, value), 1);
+  } else if (key == "nodelay") {
+    options.probe.nodelay = get_switch(key, value);
+  } else if (key == "cork") {
+    options.probe.cork = get_switch(key, value);
+  } else if (key == "busy-poll") {
+    options.probe.busy_poll = get_size(key, value);
+  } else if (key == "records") {
+    options.records = std::max<size_t>(get_size(key, value), 1);
+  } else if (key == "megabytes") {
+    options.megabytes = std::max<size_t>(get_size(key, value), 1);
+  } else if (key == "batch") {
+    options.batch = std::max<size_t>(get_size(key, value), 100);
+  } else {
+    fprintf(stderr, "unknown option %s\n", key.c_str());
+    exit(EXIT_FAILURE);
+  }
+}
+
+uint64_t nanoseconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/**
+ * the value at fraction p of sorted, which mustn't be empty
+ */
+uint64_t percentile(const std::vector<uint64_t> &sorted, double p) {
+  return sorted[(size_t)(p * (sorted.size() - 1))];
+}
+
+/**
+ * runs logserver on options.out and options.port, returning once it accepts
+ * connections
+ */
+pid_t start_server(const Options &options) {
+  unlink(options.out.c_str());
+  std::string port = std::to_string(options.port);
+  std::vector<char *> argv = {(char *)options.server.c_str(),
+                              (char *)options.out.c_str(), &port[0]};
+  argv.insert(argv.end(), options.server_options.begin(),
+              options.server_options.end());
+  argv.push_back(NULL);
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("couldn't fork");
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    execv(argv[0], argv.data());
+    perror("couldn't run logserver");
+    _exit(EXIT_FAILURE);
+  }
+
+  struct sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(options.port);
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  for (int attempt = 0; attempt < 100; attempt++) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int ready = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+    close(fd);
+    if (ready == 0 && access(options.out.c_str(), F_OK) == 0) {
+      return pid;
+    }
+    if (waitpid(pid, NULL, WNOHANG) == pid) {
+      fprintf(stderr, "logserver exited\n");
+      exit(EXIT_FAILURE);
+    }
+    usleep(50000);
+  }
+  fprintf(stderr, "logserver didn't start listening\n");
+  kill(pid, SIGTERM);
+  exit(EXIT_FAILURE);
+}
+
+void stop_server(pid_t pid, const Options &options) {
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+  unlink(options.out.c_str());
+}
+
+/**
+ * follows the output at path until stop, recording the latency of every
+ * probe line in it
+ */
+void read_probes(const std::string &path, const std::atomic<bool> &stop,
+                 std::vector<uint64_t> &latencies) {
+  int file = open(path.c_str(), O_RDONLY);
+  int notify = inotify_init1(0);
+  if (file < 0 || notify < 0 ||
+      inotify_add_watch(notify, path.c_str(), IN_MODIFY) < 0) {
+    perror("couldn't follow the output");
+    exit(EXIT_FAILURE);
+  }
+
+  std::string line;
+  char buf[1 << 16];
+  char events[4096];
+  struct pollfd pfd = {notify, POLLIN, 0};
+  while (!stop) {
+    ssize_t bytes;
+    while ((bytes = read(file, buf, sizeof(buf))) > 0) {
+      uint64_t now = nanoseconds();
+      for (char *p = buf, *end = buf + bytes; p < end;) {
+        char *lf = (char *)memchr(p, '\n', end - p);
+        line.append(p, (lf != NULL ? lf : end) - p);
+        if (lf == NULL) {
+          break;
+        }
+        size_t tag = line.find(PROBE_TAG);
+        if (tag != std::string::npos) {
+          uint64_t sent = strtoull(&line[tag + cstrlen(PROBE_TAG)], NULL, 10);
+          latencies.push_back(now - sent);
+        }
+        line.clear();
+        p = lf + 1;
+      }
+    }
+    if (poll(&pfd, 1, 10) > 0) {
+      read(notify, events, sizeof(events));
+    }
+  }
+  close(notify);
+  close(file);
+}
+
+int mixed(Options &options) {
+  pid_t server = start_server(options);
+
+  std::atomic<bool> stop(false);
+  std::atomic<bool> read_stop(false);
+  std::atomic<uint64_t> flooded(0);
+  std::atomic<uint64_t> probed(0);
+  std::vector<uint64_t> latencies;
+  std::thread reader(read_probes, options.out, std::cref(read_stop),
+                     std::ref(latencies));
+
+  std::vector<std::thread> clients;
+  for (size_t i = 0; i < options.firehose; i++) {
+    clients.emplace_back([&]() {
+      LogClient client(options.port);
+      std::string message(options.size, 'x');
+      uint64_t sent = 0;
+      while (!stop) {
+        sent += client.writeLog(INFO, message) == 0;
+      }
+      flooded += sent;
+    });
+  }
+  for (size_t i = 0; i < options.probes; i++) {
+    clients.emplace_back([&, i]() {
+      LogClient client(options.port, options.probe);
+      uint64_t period = 1000000000ull / options.rate;
+      // spread the probes across the period rather than sending together
+      uint64_t next = nanoseconds() + period * i / options.probes;
+      while (!stop) {
+        struct timespec at = {(time_t)(next / 1000000000),
+                              (long)(next % 1000000000)};
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL);
+        probed +=
+            client.writeLog(INFO, PROBE_TAG + std::to_string(nanoseconds())) ==
+            0;
+        next += period;
+      }
+    });
+  }
+
+  sleep(options.seconds);
+  stop = true;
+  for (std::thread &client : clients) {
+    client.join();
+  }
+  // let the server catch up on the firehose's backlog
+  sleep(1);
+  read_stop = true;
+  reader.join();
+  stop_server(server, options);
+
+  printf("firehose: %zu clients, %.0f logs/s\n", options.firehose,
+         (double)flooded / options.seconds);
+  printf("probes: %zu clients at %zu logs/s, %zu of %lu logs arrived\n",
+         options.probes, options.rate, latencies.size(), probed.load());
+  if (latencies.empty()) {
+    return EXIT_FAILURE;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  printf("probe latency us: p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+         percentile(latencies, 0.5) / 1e3, percentile(latencies, 0.99) / 1e3,
+         percentile(latencies, 0.999) / 1e3, latencies.back() / 1e3);
+  return EXIT_SUCCESS;
+}
+
+/**
+ * lines in the file at path
+ */
+size_t count_lines(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    perror("couldn't read the output");
+    exit(EXIT_FAILURE);
+  }
+  size_t lines = 0;
+  char buf[1 << 16];
+  ssize_t bytes;
+  while ((bytes = read(fd, buf, sizeof(buf))) > 0) {
+    lines += std::count(buf, buf + bytes, '\n');
+  }
+  close(fd);
+  return lines;
+}
+
+int http(Options &options) {
+  std::string listen = "--http=" + std::to_string(options.http);
+  options.server_options.insert(options.server_options.begin(), &listen[0]);
+  pid_t server = start_server(options);
+
+  std::string body;
+  for (size_t i = 0; i < options.lines; i++) {
+    body += std::to_string(INFO) + ":" + std::string(options.size, 'x') + "\n";
+  }
+  std::string request = "POST / HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+                        "Content-Length: " +
+                        std::to_string(body.size()) + "\r\n\r\n" + body;
+
+  std::atomic<bool> stop(false);
+  std::atomic<uint64_t> accepted(0);
+  std::atomic<uint64_t> requests(0);
+  std::vector<std::thread> clients;
+  for (size_t i = 0; i < options.firehose; i++) {
+    clients.emplace_back([&]() {
+      struct sockaddr_in addr = {0};
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons(options.http);
+      addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+      int fd = socket(AF_INET, SOCK_STREAM, 0);
+      if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("couldn't connect to the HTTP port");
+        exit(EXIT_FAILURE);
+      }
+
+      // one request at a time on a kept alive connection, each answered
+      // with a 204 and no body once all of its records are queued
+      char response[4096];
+      uint64_t sent = 0;
+      while (!stop) {
+        for (size_t at = 0; at < request.size();) {
+          ssize_t n = send(fd, request.data() + at, request.size() - at,
+                           MSG_NOSIGNAL);
+          if (n <= 0) {
+            perror("couldn't send a request");
+            exit(EXIT_FAILURE);
+          }
+          at += n;
+        }
+        size_t len = 0;
+        while (memmem(response, len, "\r\n\r\n", 4) == NULL) {
+          ssize_t n = recv(fd, response + len, sizeof(response) - len, 0);
+          if (n <= 0) {
+            fprintf(stderr, "logserver closed the connection\n");
+            exit(EXIT_FAILURE);
+          }
+          len += n;
+        }
+        if (len < 12 || memcmp(response, "HTTP/1.1 204", 12) != 0) {
+          fprintf(stderr, "request refused: %.*s\n", (int)len, response);
+          exit(EXIT_FAILURE);
+        }
+        sent++;
+      }
+      close(fd);
+      requests += sent;
+      accepted += sent * options.lines;
+    });
+  }
+
+  sleep(options.seconds);
+  stop = true;
+  for (std::thread &client : clients) {
+    client.join();
+  }
+  // let the server catch up on what it has queued
+  sleep(1);
+  size_t written = count_lines(options.out);
+  stop_server(server, options);
+
+  printf("http: %zu clients, %zu records of %zu bytes per request\n",
+         options.firehose, options.lines, options.size);
+  printf("%.0f requests/s, %.0f records/s, %.1f MB/s of body\n",
+         (double)requests / options.seconds,
+         (double)accepted / options.seconds,
+         (double)requests * body.size() / options.seconds / 1e6);
+  printf("%zu of %lu records written\n", written, accepted.load());
+  return written >= accepted ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * prints the nanoseconds per record taken by baseline and candidate, each of
+ * which formats record i into out and returns the bytes written
+ */
+template <typename Baseline, typename Candidate>
+void compare(const char *name, size_t records, Baseline baseline,
+             Candidate candidate) {
+  char out[256];
+  double ns[2];
+  // the sum of the lengths keeps the compiler from dropping the work
+  size_t bytes = 0;
+  for (int which = 0; which < 2; which++) {
+    uint64_t start = nanoseconds();
+    for (size_t i = 0; i < records; i++) {
+      bytes += which == 0 ? baseline(i, out) : candidate(i, out);
+    }
+    ns[which] = (double)(nanoseconds() - start) / records;
+  }
+  printf("%-10s snprintf %7.1f ns, fastfmt %7.1f ns, %.1fx (%zu bytes)\n",
+         name, ns[0], ns[1], ns[0] / ns[1], bytes);
+}
+
+int format(Options &options) {
+  // a record every 10us, about what a busy server sees
+  const uint64_t start = 1720526400ull * 1000000000;
+  const uint64_t step = 10000;
+
+  compare(
+      "timestamp", options.records,
+      [&](size_t i, char *out) {
+        uint64_t time = start + i * step;
+        time_t secs = time / 1000000000;
+        struct tm tm;
+        gmtime_r(&secs, &tm);
+        size_t len = strftime(out, DATE_LEN + 1, "%Y-%m-%dT%H:%M:%S", &tm);
+        return len + snprintf(out + len, 6, ".%03uZ",
+                              (unsigned)(time / 1000000 % 1000));
+      },
+      [&, dates = DateCache()](size_t i, char *out) mutable {
+        uint64_t time = start + i * step;
+        char *end = dates.format(out, time / 1000000000);
+        *end++ = '.';
+        end = fmt_3digits(end, time / 1000000 % 1000);
+        *end++ = 'Z';
+        return (size_t)(end - out);
+      });
+
+  compare(
+      "pid", options.records,
+      [](size_t i, char *out) {
+        return (size_t)snprintf(out, 21, "%u", (unsigned)(i * 2654435761u));
+      },
+      [](size_t i, char *out) {
+        return (size_t)(fmt_u64(out, (unsigned)(i * 2654435761u)) - out);
+      });
+
+  LogRecord record;
+  record.level = INFO;
+  record.source = "127.0.0.1";
+  record.message = "request served in 12ms";
+  LineFormat line("{time} [{level}] {pid} {source}: {message}");
+  compare(
+      "line", options.records,
+      [&](size_t i, char *out) {
+        uint64_t time = start + i * step;
+        time_t secs = time / 1000000000;
+        struct tm tm;
+        gmtime_r(&secs, &tm);
+        size_t len = strftime(out, DATE_LEN + 1, "%Y-%m-%dT%H:%M:%S", &tm);
+        return len + snprintf(out + len, 256 - len, ".%03uZ [%s] %u %s: %s",
+                              (unsigned)(time / 1000000 % 1000),
+                              LEVELS[record.level].name, (unsigned)i,
+                              record.source.c_str(), record.message.c_str());
+      },
+      [&](size_t i, char *out) {
+        record.time = start + i * step;
+        record.pid = i;
+        return (size_t)(line.format(record, out) - out);
+      });
+  return EXIT_SUCCESS;
+}
+
+/**
+ * 1000 request logs, one in four ending in secret<0-99>=<value>
+ */
+std::vector<std::string> request_messages() {
+  std::vector<std::string> messages;
+  for (size_t i = 0; i < 1000; i++) {
+    std::string message = "GET /api/v1/users/" + std::to_string(i * 7919) +
+                          "?page=" + std::to_string(i % 13) +
+                          " 200 in " + std::to_string(i % 97) + "ms from " +
+                          "10.0." + std::to_string(i % 256) + ".17";
+    if (i % 4 == 0) {
+      message += " secret" + std::to_string(i % 100) + "=" +
+                 std::to_string(i * 104729);
+    }
+    messages.push_back(message);
+  }
+  return messages;
+}
+
+int redact(Options &options) {
+  std::vector<std::string> messages = request_messages();
+
+  for (size_t count : {0, 10, 100}) {
+    std::vector<std::string> patterns;
+    for (size_t p = 0; p < count; p++) {
+      patterns.push_back(p % 2 == 0 ? "secret" + std::to_string(p) + "=*"
+                                    : "token" + std::to_string(p));
+    }
+    Redactor redactor(patterns);
+
+    size_t bytes = 0;
+    size_t redacted = 0;
+    std::string text;
+    uint64_t start = nanoseconds();
+    for (size_t i = 0; i < options.records; i++) {
+      text = messages[i % messages.size()];
+      bytes += text.size();
+      redacted += redactor.apply(text);
+    }
+    double ns = nanoseconds() - start;
+    printf("%3zu patterns: %6.1f ns/record, %7.1f MB/s, %zu redacted\n",
+           count, ns / options.records, bytes / ns * 1e3, redacted);
+  }
+  return EXIT_SUCCESS;
+}
+
+int alert(Options &options) {
+  std::vector<LogRecord> records;
+  const log_t levels[] = {INFO, INFO, WARN, ERROR};
+  for (const std::string &message : request_messages()) {
+    LogRecord record = {levels[records.size() % 4], 0, 0, "127.0.0.1", "",
+                        message};
+    records.push_back(record);
+  }
+
+  // a quarter each of every level, one level, text on every level and text
+  // on two levels, none reaching its threshold so nothing fires
+  const char *kinds[] = {"*:1000000000/1", "error:1000000000/1",
+                         "*:1000000000/1:secret",
+                         "warn,error:1000000000/1:timeout"};
+  for (size_t count : {0, 8, 32}) {
+    std::vector<std::string> rules;
+    for (size_t r = 0; r < count; r++) {
+      rules.push_back("r" + std::to_string(r) + ":" + kinds[r % 4] +
+                      (r % 4 == 2 ? std::to_string(r % 100) + "=" : ""));
+    }
+    AlertRules alerts(rules, "", "");
+
+    uint64_t start = nanoseconds();
+    for (size_t i = 0; i < options.records; i++) {
+      LogRecord &record = records[i % records.size()];
+      record.time = start + i * 10000;
+      alerts.apply(record);
+    }
+    double ns = (double)(nanoseconds() - start) / options.records;
+    printf("%2zu rules: %6.1f ns/record, %5.1f ns/rule\n", count, ns,
+           count > 0 ? ns / count : 0.0);
+  }
+  return EXIT_SUCCESS;
+}
+
+int syslog(Options &options) {
+  const std::string messages[] = {
+      "<165>1 2003-08-24T05:14:15.000003-07:00 192.0.2.1 myproc 8710 - "
+      "[exampleSDID@32473 iut=\"3\" eventSource=\"Application\" "
+      "eventID=\"1011\"] An application event log entry",
+      "<34>1 2003-10-11T22:14:15.003Z mymachine.example.com su - ID47 - "
+      "'su root' failed for lonvick on /dev/pts/8",
+      "<13>Oct 11 22:14:15 mymachine sshd[1234]: Accepted publickey for user "
+      "from 10.0.0.1 port 52314 ssh2",
+      "<15>Oct 11 22:14:15 cron[42]: (root) CMD (run-parts /etc/cron.hourly)"};
+
+  // the lengths of what was parsed keep the compiler from dropping the work
+  size_t bytes = 0;
+  syslog_msg_t msg;
+  uint64_t start = nanoseconds();
+  for (size_t i = 0; i < options.records; i++) {
+    const std::string &message = messages[i % 4];
+    parse_syslog(message.data(), message.size(), msg);
+    std::string_view structured = msg.structured, name, value;
+    while (next_sd_param(structured, name, value)) {
+      bytes += value.size();
+    }
+    bytes += msg.app.size() + msg.message.size();
+  }
+  double ns = (double)(nanoseconds() - start) / options.records;
+  printf("parse + params: %5.1f ns/msg, %5.2fM msgs/s (%zu bytes)\n", ns,
+         1e3 / ns, bytes);
+
+  // newline framed, as on a syslog TCP connection
+  std::string stream;
+  for (size_t i = 0; i < 4096; i++) {
+    stream += messages[i % 4] + "\n";
+  }
+  size_t parsed = 0;
+  start = nanoseconds();
+  while (parsed < options.records) {
+    std::string_view frame;
+    ssize_t used;
+    for (size_t at = 0; (used = syslog_frame(stream.data() + at,
+                                             stream.size() - at, frame)) > 0;
+         at += used) {
+      parse_syslog(frame.data(), frame.size(), msg);
+      bytes += msg.message.size();
+      parsed++;
+    }
+  }
+  ns = (double)(nanoseconds() - start) / parsed;
+  printf("frame + parse:  %5.1f ns/msg, %5.2fM msgs/s (%zu bytes)\n", ns,
+         1e3 / ns, bytes);
+  return EXIT_SUCCESS;
+}
+
+int writer(Options &options) {
+  std::string batch;
+  while (batch.size() + 100 <= options.batch) {
+    batch.append(99, 'x');
+    batch += '\n';
+  }
+  size_t batches = (options.megabytes << 20) / batch.size();
+
+  const std::pair<const char *, write_mode_t> modes[] = {
+      {"append", write_mode_t::APPEND},
+      {"fadvise", write_mode_t::FADVISE},
+      {"direct", write_mode_t::DIRECT},
+      {"mmap", write_mode_t::MMAP}};
+  for (const auto &mode : modes) {
+    LoggerConfig config;
+    config.name = options.out;
+    config.write_mode = mode.second;
+    unlink(options.out.c_str());
+
+    uint64_t start = nanoseconds();
+    {
+      LogWriter writer(config);
+      for (size_t i = 0; i < batches; i++) {
+        writer.append(batch.data(), batch.size());
+        writer.flush();
+      }
+    }
+    double seconds = (nanoseconds() - start) / 1e9;
+    unlink(options.out.c_str());
+    printf("%-8s %7.1f MB/s, %zu x %zu byte appends\n", mode.first,
+           batches * batch.size() / seconds / (1 << 20), batches,
+           batch.size());
+  }
+  return EXIT_SUCCESS;
+}
+
+int verify(Options &options) {
+  std::string batch;
+  while (batch.size() + 100 <= options.batch) {
+    batch.append(99, 'x');
+    batch += '\n';
+  }
+  size_t batches = (options.megabytes << 20) / batch.size();
+  std::string frames = options.out + CHECKSUM_SUFFIX;
+  unlink(options.out.c_str());
+  unlink(frames.c_str());
+  {
+    LoggerConfig config;
+    config.name = options.out;
+    config.checksum = true;
+    LogWriter writer(config);
+    for (size_t i = 0; i < batches; i++) {
+      writer.append(batch.data(), batch.size());
+      writer.flush();
+    }
+  }
+
+  int status = EXIT_SUCCESS;
+  for (bool cold : {false, true}) {
+    if (cold) {
+      // written back first, as only clean pages can be dropped
+      for (const std::string &path : {options.out, frames}) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0 || fsync(fd) < 0 ||
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) != 0) {
+          perror("couldn't evict the segment");
+          exit(EXIT_FAILURE);
+        }
+        close(fd);
+      }
+    }
+
+    uint64_t start = nanoseconds();
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("couldn't fork");
+      exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+      std::vector<char *> argv = {(char *)options.verifier.c_str()};
+      argv.insert(argv.end(), options.server_options.begin(),
+                  options.server_options.end());
+      argv.push_back((char *)options.out.c_str());
+      argv.push_back(NULL);
+      execv(argv[0], argv.data());
+      perror("couldn't run logverify");
+      _exit(EXIT_FAILURE);
+    }
+    int exited;
+    waitpid(pid, &exited, 0);
+    double seconds = (nanoseconds() - start) / 1e9;
+    if (!WIFEXITED(exited) || WEXITSTATUS(exited) != 0) {
+      status = EXIT_FAILURE;
+    }
+    printf("%-6s %7.1f MB/s, %zu x %zu byte frames\n", cold ? "cold" : "cached",
+           batches * batch.size() / seconds / (1 << 20), batches, batch.size());
+  }
+  unlink(options.out.c_str());
+  unlink(frames.c_str());
+  return status;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s benchmark [options...] [-- logserver "
+                    "options...]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  Options options;
+  int i = 2;
+  for (; i < argc && strcmp(argv[i], "--") != 0; i++) {
+    parse_option(options, argv[i]);
+  }
+  for (i++; i < argc; i++) {
+    options.server_options.push_back(argv[i]);
+  }
+
+  std::string benchmark = argv[1];
+  if (benchmark == "mixed") {
+    return mixed(options);
+  } else if (benchmark == "http") {
+    return http(options);
+  } else if (benchmark == "format") {
+    return format(options);
+  } else if (benchmark == "redact") {
+    return redact(options);
+  } else if (benchmark == "verify") {
+    return verify(options);
+  } else if (benchmark == "writer") {
+    return writer(options);
+  } else if (benchmark == "alert") {
+    return alert(options);
+  } else if (benchmark == "syslog") {
+    return syslog(options);
+  }
+  fprintf(stderr, "unknown benchmark %s\n", benchmark.c_str());
+  return EXIT_FAILURE;
+}
@@ -1,33 +1,180 @@
 #include "logclient.hpp"
 
-LogClient::LogClient(uint16_t port) : port(port) {
+static uint64_t coarse_milliseconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+LogClient::LogClient(uint16_t port, LogClientOptions options)
+    : port(port), fd(-1), last_write(0), options(options),
+      source_valid(true) {
   addr = {0};
   addr.sin_family = AF_INET;
   addr.sin_port = htons(port);
   addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+  header_fields = ",pid=" + std::to_string(getpid());
+  // rejected rather than sent, the server would take the rest of the source
+  // as another field or as the message
+  if (options.source.find_first_of(std::string(",:\0", 3)) !=
+      std::string::npos) {
+    source_valid = false;
+  } else if (!options.source.empty()) {
+    header_fields += ",src=" + options.source;
+  }
 }
 
-void LogClient::format_log(log_t level, std::string &log) {
-  log = std::to_string(level) + ":" + log;
+LogClient::~LogClient() { disconnect(); }
+
+void LogClient::format_log(log_t level, std::string &log,
+                           const trace_context_t *trace) {
+  char digits[4];
+  char *end = fmt_u64(digits, level);
+
+  // ,trace=<32 hex>,span=<16 hex>
+  char context[2 * (TRACE_ID_LEN + SPAN_ID_LEN) + 13];
+  char *context_end = context;
+  if (trace != nullptr && id_is_set(trace->trace_id, TRACE_ID_LEN)) {
+    context_end = (char *)mempcpy(context_end, ",trace=", 7);
+    context_end = fmt_hex_id(context_end, trace->trace_id, TRACE_ID_LEN);
+  }
+  if (trace != nullptr && id_is_set(trace->span_id, SPAN_ID_LEN)) {
+    context_end = (char *)mempcpy(context_end, ",span=", 6);
+    context_end = fmt_hex_id(context_end, trace->span_id, SPAN_ID_LEN);
+  }
+
+  std::string formatted;
+  formatted.reserve((end - digits) + header_fields.size() +
+                    (context_end - context) + 1 + log.size());
+  formatted.append(digits, end);
+  formatted += header_fields;
+  formatted.append(context, context_end);
+  formatted += ':';
+  formatted += log;
+  log.swap(formatted);
 }
 
-int LogClient::writeLog(log_t level, std::string log) {
-  ssize_t fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (errno != 0) {
+int LogClient::tune_socket(int fd) {
+  int on = 1;
+  if (options.sndbuf > 0 &&
+      setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &options.sndbuf,
+                 sizeof(options.sndbuf)) < 0) {
     return -1;
   }
+  if (options.busy_poll > 0 &&
+      setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &options.busy_poll,
+                 sizeof(options.busy_poll)) < 0) {
+    return -1;
+  }
+  if (options.nodelay &&
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0) {
+    return -1;
+  }
+  if (options.cork &&
+      setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)) < 0) {
+    return -1;
+  }
+  return 0;
+}
 
-  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-    close(fd);
+int LogClient::connect_server() {
+  if (fd >= 0) {
+    return 0;
+  }
+
+  if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
     return -1;
   }
 
-  LogClient::format_log(level, log);
-  if (write(fd, log.c_str(), log.size() + 1) < 0) {
-    close(fd);
+  if (tune_socket(fd) < 0 ||
+      connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    disconnect();
     return -1;
   }
 
-  close(fd);
   return 0;
 }
+
+void LogClient::disconnect() {
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+bool LogClient::peer_closed() {
+  char byte;
+  ssize_t bytes = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  return bytes == 0 ||
+         (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+          errno != EINTR);
+}
+
+int LogClient::send_all(const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t bytes = send(fd, buf, len, MSG_NOSIGNAL);
+    if (bytes < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    buf += bytes;
+    len -= bytes;
+  }
+
+  if (options.cork) {
+    int off = 0, on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+    setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+  }
+  return 0;
+}
+
+int LogClient::writeLog(log_t level, std::string log) {
+  LogClient::format_log(level, log);
+  return send_log(log);
+}
+
+int LogClient::writeLog(log_t level, std::string log,
+                        const trace_context_t &trace) {
+  LogClient::format_log(level, log, &trace);
+  return send_log(log);
+}
+
+int LogClient::send_log(const std::string &log) {
+  if (!source_valid) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  // the server may have dropped an idle connection, so a failed send on a
+  // reused connection is retried once on a fresh one
+  uint64_t now = coarse_milliseconds();
+  for (int attempt = 0; attempt < 2; attempt++) {
+    // a send on a connection the server already closed (e.g. as idle) is
+    // still taken into the local buffer and only then lost to the RST, so
+    // one that sat unused is checked before it is written to
+    if (fd >= 0 && now - last_write >= LOGCLIENT_IDLE_CHECK_MS &&
+        peer_closed()) {
+      disconnect();
+    }
+    bool reused = fd >= 0;
+    if (connect_server() < 0) {
+      return -1;
+    }
+
+    if (send_all(log.c_str(), log.size() + 1) == 0) {
+      last_write = now;
+      return 0;
+    }
+
+    disconnect();
+    if (!reused) {
+      break;
+    }
+  }
+
+  return -1;
+}
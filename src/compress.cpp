@@ -0,0 +1,215 @@
+/*
+ * Author: Elijah Mullens
+ * Date: 09/07/2024
+ */
+
+#include "compress.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef HAVE_ZSTD
+#include <zdict.h>
+#include <zstd.h>
+#endif
+
+dictionary_t::~dictionary_t() {
+#ifdef HAVE_ZSTD
+  ZSTD_freeCDict(cdict);
+#endif
+}
+
+std::shared_ptr<const dictionary_t>
+train_dictionary(const std::vector<std::string> &samples, int level) {
+#ifdef HAVE_ZSTD
+  std::string joined;
+  std::vector<size_t> sizes;
+  for (const std::string &sample : samples) {
+    joined += sample;
+    sizes.push_back(sample.size());
+  }
+  std::string content(COMPRESS_DICT_SIZE, '\0');
+  size_t len = ZDICT_trainFromBuffer(&content[0], content.size(), joined.data(),
+                                     sizes.data(), sizes.size());
+  if (ZDICT_isError(len)) {
+    fprintf(stderr, "couldn't train dictionary: %s\n", ZDICT_getErrorName(len));
+    return nullptr;
+  }
+
+  content.resize(len);
+  auto dict = std::make_shared<dictionary_t>();
+  dict->id = ZDICT_getDictID(content.data(), len);
+  dict->cdict = ZSTD_createCDict(content.data(), len, level);
+  dict->content = std::move(content);
+  return dict;
+#else
+  return nullptr;
+#endif
+}
+
+#ifdef HAVE_ZSTD
+/**
+ * a compression context per thread, freed when the thread exits
+ */
+struct context_t {
+  ZSTD_CCtx *ctx = ZSTD_createCCtx();
+
+  ~context_t() { ZSTD_freeCCtx(ctx); }
+};
+#endif
+
+bool compress_chunk(const std::string &in, std::string &out,
+                    const dictionary_t *dict, int level) {
+#ifdef HAVE_ZSTD
+  static thread_local context_t context;
+  out.resize(ZSTD_compressBound(in.size()));
+  size_t len;
+  if (dict != nullptr) {
+    len = ZSTD_compress_usingCDict(context.ctx, &out[0], out.size(), in.data(),
+                                   in.size(), dict->cdict);
+  } else {
+    len = ZSTD_compressCCtx(context.ctx, &out[0], out.size(), in.data(),
+                            in.size(), level);
+  }
+  if (ZSTD_isError(len) || len >= in.size()) {
+    return false;
+  }
+  out.resize(len);
+  return true;
+#else
+  return false;
+#endif
+}
+
+Compressor::Compressor(bool enabled)
+    : on(enabled), sample_bytes(0), since_trained(0),
+      training(false), stopping(false) {
+  if (!on) {
+    return;
+  }
+#ifdef HAVE_ZSTD
+  trainer = std::thread(&Compressor::train, this);
+#else
+  fprintf(stderr, "compression needs a build with zstd\n");
+  exit(EXIT_FAILURE);
+#endif
+}
+
+bool Compressor::enabled() const { return on; }
+
+bool Compressor::compress(const std::string &body, std::string &out,
+                          std::shared_ptr<const dictionary_t> &dict) {
+#ifdef HAVE_ZSTD
+  {
+    std::lock_guard<std::mutex> lock(trainlock);
+    if (trained) {
+      current = std::move(trained);
+    }
+
+    samples.push_back(body);
+    sample_bytes += body.size();
+    while (sample_bytes > COMPRESS_SAMPLE_SIZE) {
+      sample_bytes -= samples.front().size();
+      samples.pop_front();
+    }
+    since_trained += body.size();
+    if (!training &&
+        since_trained >= (current ? COMPRESS_RETRAIN : COMPRESS_SAMPLE_SIZE)) {
+      pending.assign(samples.begin(), samples.end());
+      training = true;
+      since_trained = 0;
+      traincv.notify_all();
+    }
+  }
+
+  if (!compress_chunk(body, out, current.get(), COMPRESS_LEVEL)) {
+    return false;
+  }
+  dict = current;
+  return true;
+#else
+  return false;
+#endif
+}
+
+void Compressor::train() {
+#ifdef HAVE_ZSTD
+  std::unique_lock<std::mutex> lock(trainlock);
+  while (true) {
+    traincv.wait(lock, [this] { return !pending.empty() || stopping; });
+    if (stopping) {
+      return;
+    }
+
+    std::vector<std::string> set;
+    set.swap(pending);
+    lock.unlock();
+
+    std::shared_ptr<const dictionary_t> dict =
+        train_dictionary(set, COMPRESS_LEVEL);
+
+    lock.lock();
+    if (dict) {
+      trained = std::move(dict);
+    }
+    training = false;
+  }
+#endif
+}
+
+Compressor::~Compressor() {
+  if (!on) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(trainlock);
+    stopping = true;
+    traincv.notify_all();
+  }
+  trainer.join();
+}
+
+void Decompressor::add(const std::string &content) {
+#ifdef HAVE_ZSTD
+  uint32_t id = ZDICT_getDictID(content.data(), content.size());
+  if (id != 0 && dictionaries.find(id) == dictionaries.end()) {
+    dictionaries[id] = ZSTD_createDDict(content.data(), content.size());
+  }
+#endif
+}
+
+bool Decompressor::decompress(const std::string &in, std::string &out) const {
+#ifdef HAVE_ZSTD
+  unsigned long long size = ZSTD_getFrameContentSize(in.data(), in.size());
+  if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN) {
+    return false;
+  }
+
+  ZSTD_DDict_s *dict = nullptr;
+  uint32_t id = ZSTD_getDictID_fromFrame(in.data(), in.size());
+  if (id != 0) {
+    auto found = dictionaries.find(id);
+    if (found == dictionaries.end()) {
+      return false;
+    }
+    dict = found->second;
+  }
+
+  out.resize(size);
+  ZSTD_DCtx *ctx = ZSTD_createDCtx();
+  size_t len = ZSTD_decompress_usingDDict(ctx, &out[0], out.size(), in.data(),
+                                          in.size(), dict);
+  ZSTD_freeDCtx(ctx);
+  return !ZSTD_isError(len) && len == size;
+#else
+  return false;
+#endif
+}
+
+Decompressor::~Decompressor() {
+#ifdef HAVE_ZSTD
+  for (auto &entry : dictionaries) {
+    ZSTD_freeDDict(entry.second);
+  }
+#endif
+}
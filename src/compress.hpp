@@ -0,0 +1,131 @@
+#ifndef _COMPRESS_H
+#define _COMPRESS_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// zstd's types, so the header doesn't depend on zstd being installed
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
+#define COMPRESS_LEVEL 3
+// level closed archives are recompressed at, see recompress_archive
+#define COMPRESS_COLD_LEVEL 19
+// most bytes a trained dictionary takes up
+#define COMPRESS_DICT_SIZE (16 * 1024)
+// the most recent chunk bytes kept to train the dictionary on
+#define COMPRESS_SAMPLE_SIZE (1024 * 1024)
+// chunk bytes compressed before the dictionary is trained again
+#define COMPRESS_RETRAIN (64 * 1024 * 1024)
+
+/**
+ * a trained dictionary, every frame compressed with it carries its id
+ */
+struct dictionary_t {
+  uint32_t id;
+  std::string content;
+  ZSTD_CDict_s *cdict;
+
+  ~dictionary_t();
+};
+
+/**
+ * trains a dictionary on samples for compressing at level, null if zstd
+ * can't build one from them
+ */
+std::shared_ptr<const dictionary_t>
+train_dictionary(const std::vector<std::string> &samples, int level);
+
+/**
+ * compresses in into out at level, or with dict's level if there's one
+ *
+ * returns false if in doesn't get any smaller
+ */
+bool compress_chunk(const std::string &in, std::string &out,
+                    const dictionary_t *dict, int level);
+
+/**
+ * compresses chunks with zstd and a dictionary trained on a sample of recent
+ * chunks, so even small chunks compress well
+ *
+ * the first dictionary is trained once COMPRESS_SAMPLE_SIZE bytes have been
+ * seen and it's retrained every COMPRESS_RETRAIN bytes, both on a background
+ * thread, until then chunks are compressed with the last dictionary or none
+ */
+class Compressor {
+public:
+  /**
+   * compression is off unless enabled, which exits if built without zstd
+   */
+  Compressor(bool enabled);
+
+  bool enabled() const;
+
+  /**
+   * compresses body into out, setting dict to the dictionary it used or null
+   *
+   * returns false if body doesn't get any smaller and should be kept as is
+   */
+  bool compress(const std::string &body, std::string &out,
+                std::shared_ptr<const dictionary_t> &dict);
+
+  ~Compressor();
+
+private:
+  bool on;
+  std::shared_ptr<const dictionary_t> current;
+
+  std::deque<std::string> samples;
+  size_t sample_bytes;
+  size_t since_trained;
+
+  // trainer takes the samples in pending and leaves the result in trained
+  std::thread trainer;
+  std::mutex trainlock;
+  std::condition_variable traincv;
+  std::vector<std::string> pending;
+  std::shared_ptr<const dictionary_t> trained;
+  bool training;
+  bool stopping;
+
+  /**
+   * body of the trainer thread
+   */
+  void train();
+};
+
+/**
+ * decompresses chunks written by Compressor given the dictionaries they use
+ */
+class Decompressor {
+public:
+  Decompressor() = default;
+
+  Decompressor(const Decompressor &) = delete;
+
+  /**
+   * adds a dictionary read from the archive
+   */
+  void add(const std::string &content);
+
+  /**
+   * returns false if in isn't a frame or its dictionary is missing,
+   * threadsafe
+   */
+  bool decompress(const std::string &in, std::string &out) const;
+
+  ~Decompressor();
+
+private:
+  std::unordered_map<uint32_t, ZSTD_DDict_s *> dictionaries;
+};
+
+#endif // _COMPRESS_H
@@ -0,0 +1,70 @@
+/*
+ * Author: Elijah Mullens
+ * Date: 09/07/2024
+ */
+
+#include "crc32c.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define CRC32C_POLY 0x82f63b78
+
+static uint32_t table[256];
+
+static void init_table() {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+    }
+    table[i] = crc;
+  }
+}
+
+static uint32_t crc32c_table(uint32_t crc, const uint8_t *p, size_t len) {
+  while (len-- > 0) {
+    crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_sse42(uint32_t crc, const uint8_t *p, size_t len) {
+  uint64_t crc64 = crc;
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    crc64 = _mm_crc32_u64(crc64, word);
+    p += 8;
+    len -= 8;
+  }
+  crc = crc64;
+  while (len-- > 0) {
+    crc = _mm_crc32_u8(crc, *p++);
+  }
+  return crc;
+}
+#endif
+
+/**
+ * picks the implementation the first time it's called
+ */
+static uint32_t (*pick())(uint32_t, const uint8_t *, size_t) {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("sse4.2")) {
+    return crc32c_sse42;
+  }
+#endif
+  init_table();
+  return crc32c_table;
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+  static uint32_t (*const impl)(uint32_t, const uint8_t *, size_t) = pick();
+  return ~impl(~crc, (const uint8_t *)data, len);
+}
@@ -0,0 +1,15 @@
+#ifndef _CRC32C_H
+#define _CRC32C_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * the crc32c (Castagnoli) of len bytes at data, continuing from crc, which is
+ * 0 for the first call
+ *
+ * uses the SSE4.2 crc32 instruction when the cpu has it, a table otherwise
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+#endif // _CRC32C_H
@@ -0,0 +1,265 @@
+/*
+ * Author: Elijah Mullens
+ * Date: 09/07/2024
+ */
+
+#include "drain.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+static bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static void tokenize(std::string_view text,
+                     std::vector<std::string_view> &tokens) {
+  tokens.clear();
+  size_t i = 0;
+  while (i < text.size()) {
+    while (i < text.size() && is_space(text[i])) {
+      i++;
+    }
+    size_t start = i;
+    while (i < text.size() && !is_space(text[i])) {
+      i++;
+    }
+    if (i > start) {
+      tokens.push_back(text.substr(start, i - start));
+    }
+  }
+}
+
+static std::string join(const std::vector<std::string> &tokens) {
+  std::string text;
+  for (const std::string &token : tokens) {
+    if (!text.empty()) {
+      text += ' ';
+    }
+    text += token;
+  }
+  return text;
+}
+
+static bool has_digit(std::string_view token) {
+  for (char c : token) {
+    if (c >= '0' && c <= '9') {
+      return true;
+    }
+  }
+  return false;
+}
+
+TemplateMiner::TemplateMiner(const std::string &path)
+    : sidecar(nullptr), next_id(1) {
+  if (path.empty()) {
+    return;
+  }
+
+  // reload the templates of earlier runs so their ids aren't handed out again
+  FILE *saved = fopen(path.c_str(), "r");
+  if (saved != nullptr) {
+    std::vector<std::pair<uint32_t, std::string>> templates;
+    std::unordered_set<uint32_t> generalised;
+    char *line = nullptr;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, saved)) > 0) {
+      if (line[0] == '~') {
+        generalised.insert(strtoul(line + 1, nullptr, 10));
+        continue;
+      }
+      char *text;
+      unsigned long id = strtoul(line, &text, 10);
+      if (id == 0 || *text != ' ') {
+        continue;
+      }
+      templates.emplace_back(id, std::string(text, line + len - text));
+    }
+    free(line);
+    fclose(saved);
+
+    for (auto &saved_template : templates) {
+      uint32_t id = saved_template.first;
+      tokenize(saved_template.second, tokens);
+      if (generalised.count(id)) {
+        retired[id] = join(std::vector<std::string>(tokens.begin(),
+                                                    tokens.end()));
+      } else {
+        addCluster(id);
+      }
+      next_id = std::max(next_id, id + 1);
+    }
+  }
+
+  if ((sidecar = fopen(path.c_str(), "a")) == nullptr) {
+    perror("couldn't open template file");
+    exit(EXIT_FAILURE);
+  }
+}
+
+bool TemplateMiner::enabled() const { return sidecar != nullptr; }
+
+TemplateMiner::node_t *TemplateMiner::descend(bool create) {
+  // the last token is never part of the path, or two token messages could
+  // only ever match themselves
+  node_t *node = &roots[tokens.size()];
+  for (size_t d = 0; d < TEMPLATE_DEPTH && d + 1 < tokens.size(); d++) {
+    std::string key =
+        has_digit(tokens[d]) ? WILDCARD : std::string(tokens[d]);
+    auto child = node->children.find(key);
+    if (child == node->children.end() && key != WILDCARD &&
+        (!create || node->children.size() >= TEMPLATE_CHILDREN)) {
+      key = WILDCARD;
+      child = node->children.find(key);
+    }
+    if (child == node->children.end()) {
+      if (!create) {
+        return nullptr;
+      }
+      child = node->children.emplace(key, std::make_unique<node_t>()).first;
+    }
+    node = child->second.get();
+  }
+  return node;
+}
+
+size_t TemplateMiner::addCluster(uint32_t id) {
+  cluster_t cluster = {id, {}, 0};
+  for (std::string_view token : tokens) {
+    cluster.tokens.emplace_back(token);
+  }
+  clusters.push_back(std::move(cluster));
+  ids[id] = clusters.size() - 1;
+  descend(true)->clusters.push_back(clusters.size() - 1);
+  return clusters.size() - 1;
+}
+
+void TemplateMiner::save(const cluster_t &cluster) {
+  fprintf(sidecar, "%u", cluster.id);
+  for (const std::string &token : cluster.tokens) {
+    fputc(' ', sidecar);
+    fwrite(token.data(), 1, token.size(), sidecar);
+  }
+  fputc('\n', sidecar);
+  fflush(sidecar);
+}
+
+uint32_t TemplateMiner::mine(const std::string &message, std::string &params) {
+  std::lock_guard<std::mutex> guard(lock);
+  tokenize(message, tokens);
+
+  // the most similar template in the leaf, ties going to the one with more
+  // wildcards
+  size_t best = SIZE_MAX;
+  double best_sim = -1;
+  size_t best_wild = 0;
+  node_t *leaf = descend(false);
+  if (leaf != nullptr) {
+    for (size_t index : leaf->clusters) {
+      const cluster_t &cluster = clusters[index];
+      size_t same = 0;
+      size_t wild = 0;
+      for (size_t i = 0; i < tokens.size(); i++) {
+        if (cluster.tokens[i] == WILDCARD) {
+          wild++;
+        } else if (cluster.tokens[i] == tokens[i]) {
+          same++;
+        }
+      }
+      double sim = tokens.empty() ? 1 : (double)same / tokens.size();
+      if (sim > best_sim || (sim == best_sim && wild > best_wild)) {
+        best = index;
+        best_sim = sim;
+        best_wild = wild;
+      }
+    }
+  }
+
+  if (best != SIZE_MAX && best_sim >= TEMPLATE_SIMILARITY) {
+    cluster_t &cluster = clusters[best];
+    bool changed = false;
+    for (size_t i = 0; i < tokens.size(); i++) {
+      if (cluster.tokens[i] != WILDCARD && cluster.tokens[i] != tokens[i]) {
+        if (!changed) {
+          retired[cluster.id] = join(cluster.tokens);
+          changed = true;
+        }
+        cluster.tokens[i] = WILDCARD;
+      }
+    }
+    if (changed) {
+      fprintf(sidecar, "~%u\n", cluster.id);
+      ids.erase(cluster.id);
+      cluster.id = next_id++;
+      ids[cluster.id] = best;
+      save(cluster);
+    }
+  } else if (clusters.size() < TEMPLATE_MAX) {
+    best = addCluster(next_id++);
+    save(clusters[best]);
+  } else {
+    params = message;
+    return 0;
+  }
+
+  cluster_t &cluster = clusters[best];
+  cluster.count++;
+  params.clear();
+  for (size_t i = 0; i < tokens.size(); i++) {
+    if (cluster.tokens[i] == WILDCARD) {
+      if (!params.empty()) {
+        params += ' ';
+      }
+      params.append(tokens[i]);
+    }
+  }
+  return cluster.id;
+}
+
+std::string TemplateMiner::report() {
+  std::vector<const cluster_t *> top;
+  std::string report;
+  std::lock_guard<std::mutex> guard(lock);
+
+  for (const cluster_t &cluster : clusters) {
+    top.push_back(&cluster);
+  }
+  size_t shown = std::min(top.size(), (size_t)TEMPLATE_REPORT);
+  std::partial_sort(top.begin(), top.begin() + shown, top.end(),
+                    [](const cluster_t *a, const cluster_t *b) {
+                      return a->count > b->count;
+                    });
+
+  char line[64];
+  snprintf(line, sizeof(line), "templates %zu of %zu\n", shown, top.size());
+  report += line;
+  for (size_t i = 0; i < shown; i++) {
+    snprintf(line, sizeof(line), "%u %lu", top[i]->id,
+             (unsigned long)top[i]->count);
+    report += line;
+    for (const std::string &token : top[i]->tokens) {
+      report += ' ';
+      report += token;
+    }
+    report += '\n';
+  }
+  return report;
+}
+
+std::string TemplateMiner::text(uint32_t id) {
+  std::lock_guard<std::mutex> guard(lock);
+  auto found = ids.find(id);
+  if (found != ids.end()) {
+    return join(clusters[found->second].tokens);
+  }
+  auto old = retired.find(id);
+  return old != retired.end() ? old->second : "";
+}
+
+TemplateMiner::~TemplateMiner() {
+  if (sidecar != nullptr) {
+    fclose(sidecar);
+  }
+}
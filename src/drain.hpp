@@ -0,0 +1,114 @@
+#ifndef _DRAIN_H
+#define _DRAIN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// leading tokens used to choose a leaf of the parse tree
+#define TEMPLATE_DEPTH 2
+// children per tree node before new tokens share the wildcard child
+#define TEMPLATE_CHILDREN 100
+// fraction of tokens a message must share with a template to join it
+#define TEMPLATE_SIMILARITY 0.4
+// templates kept before unmatched messages are left without one
+#define TEMPLATE_MAX 65536
+// lines of the control report
+#define TEMPLATE_REPORT 100
+#define WILDCARD "<*>"
+
+/**
+ * online log template extraction (Drain)
+ *
+ * messages are split on whitespace and routed through a fixed depth parse
+ * tree, first by token count and then by their leading tokens (any token with
+ * a digit goes down the wildcard branch), to a leaf holding a few templates.
+ * the message joins the most similar template, which turns the tokens they
+ * disagree on into wildcards, or starts a new one
+ *
+ * a template is never changed in place, generalising it gives it a new id, so
+ * every id in the output always decodes with the same template, and the old
+ * id keeps its text for records mined before the change. templates are
+ * appended to a sidecar as "<id> <template>" lines, each generalisation
+ * preceded by a "~<old id>" line, and reloaded from it at startup so ids stay
+ * unique across restarts. only templates that haven't been generalised are
+ * matched against again, the rest just keep decoding their ids
+ */
+class TemplateMiner {
+public:
+  /**
+   * mining is off if path is empty
+   */
+  TemplateMiner(const std::string &path);
+
+  bool enabled() const;
+
+  /**
+   * finds or creates the template of message and writes the tokens in its
+   * wildcard positions to params, space separated
+   *
+   * returns the template id, or 0 once TEMPLATE_MAX templates exist and none
+   * fit, params is then the whole message
+   */
+  uint32_t mine(const std::string &message, std::string &params);
+
+  /**
+   * "templates <n> of <total>" followed by "<id> <count> <template>" for the
+   * most common templates
+   */
+  std::string report();
+
+  /**
+   * the template id was handed out for, even if it has been generalised
+   * since, empty if it never existed
+   */
+  std::string text(uint32_t id);
+
+  ~TemplateMiner();
+
+private:
+  struct cluster_t {
+    uint32_t id;
+    std::vector<std::string> tokens;
+    uint64_t count;
+  };
+
+  struct node_t {
+    std::unordered_map<std::string, std::unique_ptr<node_t>> children;
+    // indices into clusters
+    std::vector<size_t> clusters;
+  };
+
+  FILE *sidecar;
+  uint32_t next_id;
+  std::vector<cluster_t> clusters;
+  // template id -> index into clusters
+  std::unordered_map<uint32_t, size_t> ids;
+  // text of ids since generalised, records mined before (say held back by
+  // TailSampler or still on their way to the archive) decode with it
+  std::unordered_map<uint32_t, std::string> retired;
+  // parse tree roots by token count
+  std::unordered_map<size_t, node_t> roots;
+  // tokens of the message being mined
+  std::vector<std::string_view> tokens;
+  std::mutex lock;
+
+  /**
+   * the leaf for tokens, creating the path if create is set, otherwise
+   * nullptr if there is none
+   */
+  node_t *descend(bool create);
+
+  size_t addCluster(uint32_t id);
+
+  void save(const cluster_t &cluster);
+};
+
+#endif // _DRAIN_H
@@ -0,0 +1,101 @@
+#ifndef _FASTFMT_H
+#define _FASTFMT_H
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+
+/**
+ * "00" through "99", so fixed width fields are written two digits at a time
+ */
+constexpr char DIGIT_PAIRS[201] = "00010203040506070809"
+                                  "10111213141516171819"
+                                  "20212223242526272829"
+                                  "30313233343536373839"
+                                  "40414243444546474849"
+                                  "50515253545556575859"
+                                  "60616263646566676869"
+                                  "70717273747576777879"
+                                  "80818283848586878889"
+                                  "90919293949596979899";
+
+/**
+ * writes v (< 100) as exactly two digits
+ */
+inline char *fmt_2digits(char *out, unsigned v) {
+  memcpy(out, DIGIT_PAIRS + 2 * v, 2);
+  return out + 2;
+}
+
+/**
+ * writes v (< 1000) as exactly three digits
+ */
+inline char *fmt_3digits(char *out, unsigned v) {
+  *out++ = '0' + v / 100;
+  return fmt_2digits(out, v % 100);
+}
+
+/**
+ * writes v in decimal with no padding, out needs room for 20 bytes
+ */
+inline char *fmt_u64(char *out, uint64_t v) {
+  return std::to_chars(out, out + 20, v).ptr;
+}
+
+#define DATE_LEN 19
+
+/**
+ * formats timestamps as 2024-07-09T12:00:00, reusing the previous result
+ * while the second hasn't changed and only redoing the time of day while the
+ * day hasn't, so gmtime_r runs once a day rather than once a line
+ */
+class DateCache {
+public:
+  DateCache() : second(-1), day(-1) {}
+
+  /**
+   * writes the DATE_LEN characters for secs since the epoch
+   */
+  char *format(char *out, time_t secs) {
+    if (secs != second) {
+      update(secs);
+    }
+    memcpy(out, date, DATE_LEN);
+    return out + DATE_LEN;
+  }
+
+private:
+  time_t second;
+  time_t day;
+  char date[DATE_LEN];
+
+  void update(time_t secs) {
+    time_t d = secs / 86400;
+    if (d != day) {
+      struct tm tm;
+      gmtime_r(&secs, &tm);
+      char *out = date;
+      unsigned year = tm.tm_year + 1900;
+      out = fmt_2digits(out, year / 100);
+      out = fmt_2digits(out, year % 100);
+      *out++ = '-';
+      out = fmt_2digits(out, tm.tm_mon + 1);
+      *out++ = '-';
+      out = fmt_2digits(out, tm.tm_mday);
+      *out++ = 'T';
+      day = d;
+    }
+
+    unsigned tod = secs - d * 86400;
+    char *out = date + 11;
+    out = fmt_2digits(out, tod / 3600);
+    *out++ = ':';
+    out = fmt_2digits(out, tod / 60 % 60);
+    *out++ = ':';
+    fmt_2digits(out, tod % 60);
+    second = secs;
+  }
+};
+
+#endif // _FASTFMT_H
@@ -0,0 +1,291 @@
+/*
+ * Author: Elijah Mullens
+ * Date: 09/07/2024
+ */
+
+#include "logformat.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "fastfmt.hpp"
+#include "loglevel.hpp"
+
+#define TIME_LEN (DATE_LEN + 5)
+#define PID_LEN 20
+#define TEMPLATE_LEN 10
+
+/**
+ * the first \n, \r or \ in [p, end), or end, checked 16 bytes at a time
+ */
+static const char *find_escape(const char *p, const char *end) {
+#ifdef __SSE2__
+  const __m128i nl = _mm_set1_epi8('\n');
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i bs = _mm_set1_epi8('\\');
+  for (; end - p >= 16; p += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+    __m128i hits = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, nl), _mm_cmpeq_epi8(chunk, cr)),
+        _mm_cmpeq_epi8(chunk, bs));
+    int mask = _mm_movemask_epi8(hits);
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; p < end; p++) {
+    if (*p == '\n' || *p == '\r' || *p == '\\') {
+      return p;
+    }
+  }
+  return end;
+}
+
+/**
+ * the message without its trailing newlines
+ */
+static size_t trimmed_len(const std::string &message) {
+  size_t len = message.size();
+  while (len > 0 && (message[len - 1] == '\n' || message[len - 1] == '\r')) {
+    len--;
+  }
+  return len;
+}
+
+LineFormat::LineFormat(const std::string &spec, multiline_t multiline,
+                       const std::string &continuation)
+    : fixed_len(0), multiline(multiline), continuation(continuation) {
+  std::string literal;
+
+  for (size_t i = 0; i < spec.size(); i++) {
+    if (spec[i] == '}' && i + 1 < spec.size() && spec[i + 1] == '}') {
+      literal += '}';
+      i++;
+      continue;
+    }
+    if (spec[i] != '{') {
+      literal += spec[i];
+      continue;
+    }
+    if (i + 1 < spec.size() && spec[i + 1] == '{') {
+      literal += '{';
+      i++;
+      continue;
+    }
+
+    size_t close = spec.find('}', i);
+    if (close == std::string::npos) {
+      fprintf(stderr, "unterminated placeholder in line format\n");
+      exit(EXIT_FAILURE);
+    }
+    std::string name = spec.substr(i + 1, close - i - 1);
+    i = close;
+
+    op_t op;
+    if (name == "time") {
+      op = op_t::TIME;
+      fixed_len += TIME_LEN;
+    } else if (name == "level") {
+      op = op_t::LEVEL;
+      fixed_len += 8;
+    } else if (name == "prefix") {
+      op = op_t::PREFIX;
+    } else if (name == "source") {
+      op = op_t::SOURCE;
+    } else if (name == "pid") {
+      op = op_t::PID;
+      fixed_len += PID_LEN;
+    } else if (name == "message") {
+      op = op_t::MESSAGE;
+    } else if (name == "fields") {
+      op = op_t::FIELDS;
+    } else if (name == "trace") {
+      op = op_t::TRACE;
+      fixed_len += 2 * TRACE_ID_LEN;
+    } else if (name == "span") {
+      op = op_t::SPAN;
+      fixed_len += 2 * SPAN_ID_LEN;
+    } else if (name == "template") {
+      op = op_t::TEMPLATE;
+      fixed_len += TEMPLATE_LEN;
+    } else if (name == "params") {
+      op = op_t::PARAMS;
+    } else {
+      fprintf(stderr, "unknown placeholder {%s} in line format\n",
+              name.c_str());
+      exit(EXIT_FAILURE);
+    }
+
+    pushLiteral(literal);
+    literal.clear();
+    steps.push_back({op, 0, 0});
+  }
+  pushLiteral(literal);
+}
+
+void LineFormat::pushLiteral(const std::string &text) {
+  if (text.empty()) {
+    return;
+  }
+
+  steps.push_back(
+      {op_t::LITERAL, (uint32_t)literals.size(), (uint32_t)text.size()});
+  literals += text;
+  fixed_len += text.size();
+}
+
+size_t LineFormat::measure(const LogRecord &record) const {
+  size_t len = fixed_len;
+  for (const step_t &step : steps) {
+    switch (step.op) {
+    case op_t::PREFIX: {
+      len += record.level < LOG_LEVELS ? LEVELS[record.level].prefix_len : 0;
+      break;
+    }
+    case op_t::SOURCE: {
+      len += record.source.size();
+      break;
+    }
+    case op_t::MESSAGE: {
+      len += measureMessage(record.message);
+      break;
+    }
+    case op_t::FIELDS: {
+      len += record.fields.size();
+      break;
+    }
+    case op_t::PARAMS: {
+      len += record.template_id != 0 ? record.params.size()
+                                     : measureMessage(record.message);
+      break;
+    }
+    default: {
+      break;
+    }
+    }
+  }
+  return len;
+}
+
+char *LineFormat::format(const LogRecord &record, char *out) {
+  const level_info_t &info = LEVELS[record.level];
+
+  for (const step_t &step : steps) {
+    switch (step.op) {
+    case op_t::LITERAL: {
+      out = (char *)mempcpy(out, literals.data() + step.offset, step.len);
+      break;
+    }
+    case op_t::TIME: {
+      out = dates.format(out, record.time / 1000000000);
+      *out++ = '.';
+      out = fmt_3digits(out, record.time / 1000000 % 1000);
+      *out++ = 'Z';
+      break;
+    }
+    case op_t::LEVEL: {
+      out = stpcpy(out, info.name);
+      break;
+    }
+    case op_t::PREFIX: {
+      out = (char *)mempcpy(out, info.prefix, info.prefix_len);
+      break;
+    }
+    case op_t::SOURCE: {
+      out = (char *)mempcpy(out, record.source.data(), record.source.size());
+      break;
+    }
+    case op_t::PID: {
+      if (record.pid == 0) {
+        *out++ = '-';
+      } else {
+        out = fmt_u64(out, record.pid);
+      }
+      break;
+    }
+    case op_t::MESSAGE: {
+      out = formatMessage(record.message, out);
+      break;
+    }
+    case op_t::FIELDS: {
+      out = (char *)mempcpy(out, record.fields.data(), record.fields.size());
+      break;
+    }
+    case op_t::TRACE: {
+      if (id_is_set(record.trace.trace_id, TRACE_ID_LEN)) {
+        out = fmt_hex_id(out, record.trace.trace_id, TRACE_ID_LEN);
+      } else {
+        *out++ = '-';
+      }
+      break;
+    }
+    case op_t::SPAN: {
+      if (id_is_set(record.trace.span_id, SPAN_ID_LEN)) {
+        out = fmt_hex_id(out, record.trace.span_id, SPAN_ID_LEN);
+      } else {
+        *out++ = '-';
+      }
+      break;
+    }
+    case op_t::TEMPLATE: {
+      out = fmt_u64(out, record.template_id);
+      break;
+    }
+    case op_t::PARAMS: {
+      if (record.template_id != 0) {
+        out = (char *)mempcpy(out, record.params.data(), record.params.size());
+      } else {
+        out = formatMessage(record.message, out);
+      }
+      break;
+    }
+    }
+  }
+  return out;
+}
+
+size_t LineFormat::measureMessage(const std::string &message) const {
+  size_t len = message.size();
+  if (multiline == multiline_t::ESCAPE) {
+    len += message.size();
+  } else if (multiline == multiline_t::PREFIX) {
+    const char *p = message.data();
+    const char *end = p + message.size();
+    while ((p = (const char *)memchr(p, '\n', end - p)) != nullptr) {
+      len += continuation.size();
+      p++;
+    }
+  }
+  return len;
+}
+
+char *LineFormat::formatMessage(const std::string &message, char *out) const {
+  if (multiline == multiline_t::RAW) {
+    return (char *)mempcpy(out, message.data(), message.size());
+  }
+
+  const char *p = message.data();
+  const char *end = p + trimmed_len(message);
+  if (multiline == multiline_t::PREFIX) {
+    const char *nl;
+    while ((nl = (const char *)memchr(p, '\n', end - p)) != nullptr) {
+      out = (char *)mempcpy(out, p, nl + 1 - p);
+      out = (char *)mempcpy(out, continuation.data(), continuation.size());
+      p = nl + 1;
+    }
+  } else {
+    const char *hit;
+    while ((hit = find_escape(p, end)) != end) {
+      out = (char *)mempcpy(out, p, hit - p);
+      *out++ = '\\';
+      *out++ = *hit == '\n' ? 'n' : *hit == '\r' ? 'r' : '\\';
+      p = hit + 1;
+    }
+  }
+  return (char *)mempcpy(out, p, end - p);
+}
@@ -0,0 +1,86 @@
+/*
+ * Author: Elijah Mullens
+ * Date: 09/07/2024
+ */
+
+#include "hugepage.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static size_t round_huge(size_t size) {
+  return (size + HUGEPAGE_SIZE - 1) & ~(size_t)(HUGEPAGE_SIZE - 1);
+}
+
+/**
+ * touches one byte per base page so the first burst of records doesn't stall
+ * on page faults, MAP_POPULATE alone is ignored for THP on older kernels
+ */
+static void prefault(char *addr, size_t size) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  for (size_t off = 0; off < size; off += page) {
+    ((volatile char *)addr)[off] = 0;
+  }
+}
+
+/**
+ * over-maps by one huge page and trims both ends so the buffer starts on a
+ * huge page boundary, which khugepaged needs to back it with huge pages
+ */
+static void *map_aligned(size_t size) {
+  size_t span = size + HUGEPAGE_SIZE;
+  void *raw = mmap(NULL, span, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED) {
+    return nullptr;
+  }
+
+  uintptr_t start = (uintptr_t)raw;
+  uintptr_t aligned = round_huge(start);
+  if (aligned > start) {
+    munmap(raw, aligned - start);
+  }
+  size_t tail = start + span - (aligned + size);
+  if (tail > 0) {
+    munmap((void *)(aligned + size), tail);
+  }
+
+  return (void *)aligned;
+}
+
+void *huge_alloc(size_t size, hugepage_t policy) {
+  size = round_huge(size);
+
+  if (policy == hugepage_t::EXPLICIT) {
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE,
+                      -1, 0);
+    if (addr != MAP_FAILED) {
+      return addr;
+    }
+    perror("couldn't map explicit huge pages, using transparent");
+    policy = hugepage_t::TRANSPARENT;
+  }
+
+  void *addr = map_aligned(size);
+  if (addr == nullptr) {
+    perror("couldn't map buffer");
+    return nullptr;
+  }
+
+  if (policy == hugepage_t::TRANSPARENT &&
+      madvise(addr, size, MADV_HUGEPAGE) < 0) {
+    perror("couldn't advise transparent huge pages");
+  }
+
+  prefault((char *)addr, size);
+  return addr;
+}
+
+void huge_free(void *addr, size_t size) {
+  if (addr != nullptr) {
+    munmap(addr, round_huge(size));
+  }
+}
@@ -0,0 +1,31 @@
+#ifndef _HUGEPAGE_H
+#define _HUGEPAGE_H
+
+#include <cstddef>
+
+#include "logconfig.hpp"
+
+#define HUGEPAGE_SIZE (2 << 20)
+
+/**
+ * maps an anonymous, prefaulted buffer of at least size bytes, aligned to a
+ * huge page
+ * - OFF         :- regular pages
+ * - TRANSPARENT :- regular mapping advised with MADV_HUGEPAGE
+ * - EXPLICIT    :- MAP_HUGETLB from the reserved pool, falling back to
+ *                  TRANSPARENT when the pool is empty
+ *
+ * parameters:
+ * - size (size_t): bytes needed, rounded up to a whole huge page
+ * - policy (hugepage_t): where the pages should come from
+ *
+ * returns nullptr if no memory could be mapped at all
+ */
+void *huge_alloc(size_t size, hugepage_t policy);
+
+/**
+ * releases a buffer from huge_alloc, size must be the size it was asked for
+ */
+void huge_free(void *addr, size_t size);
+
+#endif // _HUGEPAGE_H
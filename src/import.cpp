@@ -0,0 +1,526 @@
+/*
+ * Author: Elijah Mullens
+ * Date: 09/07/2024
+ *
+ * [Description]
+ * Imports text logs written by logserver with the default --line-format
+ * into archives, so they can be searched with logsearch like the ones
+ * written by --archive=on. Each log becomes <log>.arc.
+ *
+ * A line is a record if it starts with a level prefix, e.g. "Info: ",
+ * optionally after a {time} timestamp, colour codes are stripped first. Any
+ * other line continues the message before it, and the "New Log" banners are
+ * skipped. Records without a timestamp get the log's modification time.
+ *
+ * Each log is split into one range per thread at record boundaries, every
+ * thread archives its range to a part of its own and the parts are joined in
+ * order, so the archive is in log order whatever the number of threads.
+ *
+ * [Format]
+ * ./logimport [options...] log...
+ *
+ * [Options]
+ * - --threads=n :- number of importing threads (default one per core)
+ * - --compress=on|off :- compress the archive's chunks with zstd (default on
+ *   when built with zstd)
+ * - --recompress=on|off :- recompress each finished archive at
+ *   COMPRESS_COLD_LEVEL, see recompress_archive (default off)
+ * - --templates=path :- mine message templates into this sidecar, see
+ *   TemplateMiner, the threads take turns at the miner (default none)
+ * - --verify=on|off :- before an archive replaces anything, decode it as
+ *   logsearch would and check every record against a crc32c of it taken
+ *   while importing, failing the import if one differs (default off)
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "archive.hpp"
+#include "crc32c.hpp"
+#include "drain.hpp"
+#include "loglevel.hpp"
+#include "logrecord.hpp"
+
+// input bytes per archive chunk, a full batch of the server
+#define IMPORT_CHUNK_SIZE (1 << 20)
+// smallest range worth a thread of its own
+#define IMPORT_MIN_RANGE (4 << 20)
+#define IMPORT_PART_SUFFIX ".import"
+// width of the dashed rules around the server's "New Log" banner
+#define BANNER_RULE_LEN 79
+
+struct Options {
+  size_t threads = 0;
+#ifdef HAVE_ZSTD
+  bool compress = true;
+#else
+  bool compress = false;
+#endif
+  bool recompress = false;
+  std::string templates;
+  bool verify = false;
+};
+
+/**
+ * what one thread made of its range
+ */
+struct part_t {
+  size_t records = 0;
+  size_t skipped = 0;
+  // of its records as logsearch will print them, see record_digest
+  uint32_t digest = 0;
+};
+
+bool get_switch(const std::string &key, const std::string &value) {
+  if (value == "on") {
+    return true;
+  } else if (value != "off") {
+    fprintf(stderr, "%s must be on or off\n", key.c_str());
+    exit(EXIT_FAILURE);
+  }
+  return false;
+}
+
+void parse_option(Options &options, char *option) {
+  std::string opt(option);
+  size_t eq = opt.find('=');
+  if (eq == std::string::npos) {
+    fprintf(stderr, "invalid option %s\n", option);
+    exit(EXIT_FAILURE);
+  }
+
+  std::string key = opt.substr(2, eq - 2);
+  std::string value = opt.substr(eq + 1);
+
+  if (key == "threads") {
+    char *end;
+    errno = 0;
+    options.threads = strtoull(value.c_str(), &end, 10);
+    if (errno != 0 || end == value.c_str() || *end != '\0') {
+      fprintf(stderr, "threads must be a number\n");
+      exit(EXIT_FAILURE);
+    }
+  } else if (key == "compress") {
+    options.compress = get_switch(key, value);
+  } else if (key == "recompress") {
+    options.recompress = get_switch(key, value);
+  } else if (key == "templates") {
+    options.templates = value;
+  } else if (key == "verify") {
+    options.verify = get_switch(key, value);
+  } else {
+    fprintf(stderr, "unknown option %s\n", key.c_str());
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * copies [begin, end) to line without its colour codes
+ */
+void strip_colour(const char *begin, const char *end, std::string &line) {
+  line.clear();
+  const char *p = begin;
+  while (p < end) {
+    const char *esc = (const char *)memchr(p, '\e', end - p);
+    if (esc == nullptr) {
+      esc = end;
+    }
+    line.append(p, esc);
+    if (esc == end) {
+      break;
+    }
+    p = esc + 1;
+    if (p < end && *p == '[') {
+      while (++p < end && !(*p >= '@' && *p <= '~')) {
+      }
+      p++;
+    }
+  }
+}
+
+/**
+ * parses the {time} at the start of line, 2024-07-09T12:00:00.000Z and a
+ * space, into nanoseconds since the epoch
+ *
+ * returns where the rest of the line starts, 0 if there's no timestamp
+ */
+size_t parse_time(const std::string &line, uint64_t &time) {
+  if (line.empty() || line[0] < '0' || line[0] > '9') {
+    return 0;
+  }
+  struct tm tm = {};
+  const char *start = line.c_str();
+  const char *p = strptime(start, "%Y-%m-%dT%H:%M:%S", &tm);
+  if (p == nullptr) {
+    return 0;
+  }
+  uint64_t nanos = 0;
+  if (*p == '.') {
+    uint64_t scale = 100000000;
+    while (*++p >= '0' && *p <= '9') {
+      nanos += (*p - '0') * scale;
+      scale /= 10;
+    }
+  }
+  if (p[0] != 'Z' || p[1] != ' ') {
+    return 0;
+  }
+  time = timegm(&tm) * 1000000000ull + nanos;
+  return p + 2 - start;
+}
+
+/**
+ * the level whose prefix line has at from, LOG_LEVELS if none
+ */
+uint8_t match_level(const std::string &line, size_t from) {
+  for (uint8_t level = HEADER + 1; level < LOG_LEVELS; level++) {
+    const level_info_t &info = LEVELS[level];
+    if (line.compare(from, info.prefix_len, info.prefix) == 0) {
+      return level;
+    }
+  }
+  return LOG_LEVELS;
+}
+
+/**
+ * whether the line at [begin, end) starts a record
+ */
+bool starts_record(const char *begin, const char *end, std::string &line) {
+  strip_colour(begin, end, line);
+  uint64_t time;
+  return match_level(line, parse_time(line, time)) != LOG_LEVELS;
+}
+
+/**
+ * the first record to start at or after p
+ */
+const char *next_record(const char *p, const char *end) {
+  std::string line;
+  while (p < end) {
+    const char *eol = (const char *)memchr(p, '\n', end - p);
+    if (eol == nullptr) {
+      eol = end;
+    }
+    if (starts_record(p, eol, line)) {
+      return p;
+    }
+    p = eol + 1;
+  }
+  return end;
+}
+
+bool is_banner_rule(const std::string &line) {
+  return line.size() == BANNER_RULE_LEN &&
+         line.find_first_not_of('-') == std::string::npos;
+}
+
+/**
+ * continues crc with the level and message of a record
+ */
+uint32_t record_digest(uint32_t crc, uint8_t level,
+                       const std::string &message) {
+  crc = crc32c(crc, &level, 1);
+  crc = crc32c(crc, message.data(), message.size());
+  return crc32c(crc, "", 1);
+}
+
+/**
+ * archives the records of [begin, end) to part + ARCHIVE_SUFFIX
+ */
+void import_range(const char *begin, const char *end, const std::string &part,
+                  const std::string &source, uint64_t mtime,
+                  const Options &options, TemplateMiner &miner,
+                  part_t &result) {
+  ArchiveWriter archive(part, miner, options.compress, false);
+  LogRecord log = {LOG_LEVELS, mtime, 0, source, "", ""};
+  bool banner = false;
+  size_t chunk = 0;
+  std::string line;
+
+  auto emit = [&]() {
+    if (log.level == LOG_LEVELS) {
+      return;
+    }
+    if (miner.enabled()) {
+      log.template_id = miner.mine(log.message, log.params);
+    }
+    if (options.verify) {
+      result.digest = record_digest(result.digest, log.level, log.message);
+    }
+    archive.add(log);
+    result.records++;
+    log.level = LOG_LEVELS;
+  };
+
+  const char *p = begin;
+  while (p < end) {
+    const char *eol = (const char *)memchr(p, '\n', end - p);
+    if (eol == nullptr) {
+      eol = end;
+    }
+    strip_colour(p, eol, line);
+    chunk += eol + 1 - p;
+    p = eol + 1;
+
+    if (is_banner_rule(line)) {
+      emit();
+      banner = !banner;
+      continue;
+    }
+    if (banner) {
+      continue;
+    }
+
+    uint64_t time = mtime;
+    size_t from = parse_time(line, time);
+    uint8_t level = match_level(line, from);
+    if (level == LOG_LEVELS) {
+      // a continuation line, nothing to continue at the start of the log
+      if (log.level == LOG_LEVELS) {
+        result.skipped++;
+      } else {
+        log.message += '\n';
+        log.message += line;
+      }
+      continue;
+    }
+
+    emit();
+    if (chunk >= IMPORT_CHUNK_SIZE) {
+      archive.flush();
+      chunk = 0;
+    }
+    log.level = level;
+    log.time = time;
+    log.message.assign(line, from + LEVELS[level].prefix_len);
+  }
+  emit();
+  archive.flush();
+}
+
+/**
+ * appends the archive at part to out, without its magic unless first
+ */
+bool join_part(int out, const std::string &part, bool first) {
+  int in = open(part.c_str(), O_RDONLY);
+  if (in < 0) {
+    return false;
+  }
+  char buf[64 * 1024];
+  ssize_t bytes;
+  bool ok = first || lseek(in, ARCHIVE_MAGIC_LEN, SEEK_SET) >= 0;
+  while (ok && (bytes = read(in, buf, sizeof(buf))) > 0) {
+    ok = write(out, buf, bytes) == bytes;
+  }
+  ok = ok && bytes == 0;
+  close(in);
+  return ok;
+}
+
+/**
+ * decodes every record of the archive at path as logsearch would and checks
+ * them, part by part, against the digests the parts were imported with
+ */
+bool verify_archive(const std::string &path,
+                    const std::vector<part_t> &results) {
+  ArchiveReader reader;
+  if (!reader.open(path)) {
+    return false;
+  }
+  // records are decoded once the dictionary holds every template
+  std::vector<std::pair<off_t, archive_header_t>> chunks;
+  archive_header_t header;
+  while (reader.next(header)) {
+    chunks.emplace_back(reader.offset(), header);
+  }
+
+  size_t part = 0;
+  size_t seen = 0;
+  uint32_t digest = 0;
+  // moves past every part whose records have all been seen, false if one
+  // doesn't match
+  auto finish_parts = [&]() {
+    while (part < results.size() && seen == results[part].records) {
+      if (digest != results[part].digest) {
+        return false;
+      }
+      part++;
+      seen = 0;
+      digest = 0;
+    }
+    return true;
+  };
+
+  std::vector<LogRecord> records;
+  for (auto &chunk : chunks) {
+    records.clear();
+    if (!reader.records(chunk.first, chunk.second, records)) {
+      return false;
+    }
+    for (LogRecord &record : records) {
+      if (!finish_parts() || part == results.size()) {
+        return false;
+      }
+      if (record.template_id != 0 && record.message.empty()) {
+        record.message =
+            expand_template(reader.text(record.template_id), record.params);
+      }
+      digest = record_digest(digest, record.level, record.message);
+      seen++;
+    }
+  }
+  return finish_parts() && part == results.size();
+}
+
+/**
+ * imports one log, returns false if it couldn't be
+ */
+bool import_log(const std::string &path, const Options &options,
+                TemplateMiner &miner) {
+  std::string out = path + ARCHIVE_SUFFIX;
+  if (access(out.c_str(), F_OK) == 0) {
+    fprintf(stderr, "%s already has an archive, skipping\n", path.c_str());
+    return false;
+  }
+
+  int file = open(path.c_str(), O_RDONLY);
+  struct stat st;
+  if (file < 0 || fstat(file, &st) < 0) {
+    fprintf(stderr, "couldn't read %s\n", path.c_str());
+    if (file >= 0) {
+      close(file);
+    }
+    return false;
+  }
+  if (st.st_size == 0) {
+    close(file);
+    printf("%s: empty\n", path.c_str());
+    return true;
+  }
+
+  const char *data = (const char *)mmap(nullptr, st.st_size, PROT_READ,
+                                        MAP_PRIVATE, file, 0);
+  close(file);
+  if (data == MAP_FAILED) {
+    perror("couldn't map log");
+    return false;
+  }
+  madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+  const char *end = data + st.st_size;
+
+  size_t threads = options.threads;
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  threads = std::max(
+      std::min(threads, (size_t)st.st_size / IMPORT_MIN_RANGE), (size_t)1);
+
+  // every range but the first starts at a record, so none splits a message
+  std::vector<const char *> bounds = {data};
+  for (size_t i = 1; i < threads; i++) {
+    const char *bound = next_record(data + st.st_size / threads * i, end);
+    if (bound > bounds.back() && bound < end) {
+      bounds.push_back(bound);
+    }
+  }
+  bounds.push_back(end);
+
+  size_t slash = path.rfind('/');
+  std::string source =
+      slash == std::string::npos ? path : path.substr(slash + 1);
+  uint64_t mtime = st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+
+  std::vector<std::string> parts;
+  std::vector<part_t> results(bounds.size() - 1);
+  std::vector<std::thread> pool;
+  for (size_t i = 0; i + 1 < bounds.size(); i++) {
+    parts.push_back(out + IMPORT_PART_SUFFIX + std::to_string(i));
+    unlink((parts.back() + ARCHIVE_SUFFIX).c_str());
+    pool.emplace_back(import_range, bounds[i], bounds[i + 1], parts.back(),
+                      std::cref(source), mtime, std::cref(options),
+                      std::ref(miner), std::ref(results[i]));
+  }
+  for (std::thread &thread : pool) {
+    thread.join();
+  }
+  munmap((void *)data, st.st_size);
+
+  // joined under a temporary name, so a failed import leaves no archive
+  std::string tmp = out + ".tmp";
+  int joined = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  bool ok = joined >= 0;
+  part_t total;
+  for (size_t i = 0; i < parts.size(); i++) {
+    std::string part = parts[i] + ARCHIVE_SUFFIX;
+    ok = ok && join_part(joined, part, i == 0);
+    unlink(part.c_str());
+    total.records += results[i].records;
+    total.skipped += results[i].skipped;
+  }
+  ok = ok && fdatasync(joined) == 0;
+  if (joined >= 0) {
+    close(joined);
+  }
+  if (ok && options.verify && !verify_archive(tmp, results)) {
+    fprintf(stderr, "archive of %s doesn't read back as imported\n",
+            path.c_str());
+    unlink(tmp.c_str());
+    return false;
+  }
+  if (!ok || rename(tmp.c_str(), out.c_str()) < 0) {
+    perror("couldn't write archive");
+    unlink(tmp.c_str());
+    return false;
+  }
+
+  std::atomic<bool> stop(false);
+  if (options.recompress && !recompress_archive(out, stop)) {
+    fprintf(stderr, "couldn't recompress %s\n", out.c_str());
+  }
+  printf("%s: %zu records to %s, %zu lines skipped\n", path.c_str(),
+         total.records, out.c_str(), total.skipped);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  std::vector<std::string> paths;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--", 2) == 0) {
+      parse_option(options, argv[i]);
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty()) {
+    fprintf(stderr, "usage: %s [options...] log...\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+#ifndef HAVE_ZSTD
+  if (options.compress || options.recompress) {
+    fprintf(stderr, "compression needs a build with zstd\n");
+    exit(EXIT_FAILURE);
+  }
+#endif
+
+  TemplateMiner miner(options.templates);
+  int status = EXIT_SUCCESS;
+  for (const std::string &path : paths) {
+    if (!import_log(path, options, miner)) {
+      status = EXIT_FAILURE;
+    }
+  }
+  return status;
+}
@@ -1,15 +1,46 @@
 #include <arpa/inet.h>
+#include <cerrno>
 #include <cstdint>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <string>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "fastfmt.hpp"
 #include "loglevel.hpp"
+#include "trace.hpp"
+
+// a connection unused for this many milliseconds is checked for having been
+// closed by the server before it is written to again, well under the
+// server's shortest idle timeout
+#define LOGCLIENT_IDLE_CHECK_MS 100
+
+/**
+ * socket tuning applied to every connection a LogClient makes
+ * - sndbuf    :- SO_SNDBUF in bytes, 0 keeps the kernel default
+ * - nodelay   :- TCP_NODELAY, send each log immediately
+ * - cork      :- TCP_CORK around each write so a log leaves as full segments
+ * - busy_poll :- SO_BUSY_POLL in microseconds, 0 disables
+ * - source    :- name sent with every log, the server uses the client's
+ *                address if empty. it can't contain ',', ':' or NUL, which
+ *                end it on the wire, every writeLog of a client given such
+ *                a source fails with EINVAL
+ */
+struct LogClientOptions {
+  int sndbuf = 0;
+  bool nodelay = false;
+  bool cork = false;
+  int busy_poll = 0;
+  std::string source;
+};
 
 class LogClient {
 public:
-  LogClient(uint16_t port);
+  LogClient(uint16_t port, LogClientOptions options = LogClientOptions());
+
+  ~LogClient();
 
   /**
    * @param level: LogLevel Enum describing the severity of the log
@@ -20,9 +51,65 @@ public:
    */
   int writeLog(log_t level, std::string log);
 
+  /**
+   * as above, tagged with the trace context of the request the log belongs
+   * to, an id left all zeros isn't sent
+   */
+  int writeLog(log_t level, std::string log, const trace_context_t &trace);
+
 private:
   uint16_t port;
+  // connection reused across logs, -1 until the first log is written
+  int fd;
+  // CLOCK_MONOTONIC_COARSE milliseconds of the last write to fd
+  uint64_t last_write;
   struct sockaddr_in addr;
+  LogClientOptions options;
+
+  // ,pid=<pid>[,src=<source>] sent after the level of every log
+  std::string header_fields;
+  // false if options.source can't be sent
+  bool source_valid;
+
+  void format_log(log_t level, std::string &log,
+                  const trace_context_t *trace = nullptr);
+
+  /**
+   * sends a formatted log
+   * @return:
+   *   -  0: Succcess
+   *   - -1: Failure
+   */
+  int send_log(const std::string &log);
+
+  /**
+   * applies options to a freshly created socket
+   * @return:
+   *   -  0: Succcess
+   *   - -1: Failure
+   */
+  int tune_socket(int fd);
+
+  /**
+   * connects to the server unless already connected
+   * @return:
+   *   -  0: Succcess
+   *   - -1: Failure
+   */
+  int connect_server();
 
-  static void format_log(log_t level, std::string &log);
+  void disconnect();
+
+  /**
+   * whether the server has closed the connection, the server never writes
+   * to it, so anything readable is the close
+   */
+  bool peer_closed();
+
+  /**
+   * @return:
+   *   -  0: Succcess
+   *   - -1: Failure
+   */
+  int send_all(const char *buf, size_t len);
 };
@@ -0,0 +1,113 @@
+#ifndef _LOGCONFIG_H
+#define _LOGCONFIG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * how the file sink hands bytes to the kernel
+ * - APPEND  :- plain O_APPEND write(2), everything stays in the page cache
+ * - FADVISE :- write(2), then sync_file_range + POSIX_FADV_DONTNEED on every
+ *              fully written block so log pages don't evict application pages
+ * - DIRECT  :- O_DIRECT writes from aligned, double-buffered blocks
+ * - MMAP    :- memcpy into fallocated, memory-mapped segments, msynced
+ *              whenever the queue drains
+ */
+enum class write_mode_t { APPEND, FADVISE, DIRECT, MMAP };
+
+/**
+ * where large internal buffers get their pages from (see huge_alloc)
+ */
+enum class hugepage_t { OFF, TRANSPARENT, EXPLICIT };
+
+/**
+ * what happens to newlines inside a message
+ * - RAW    :- written as is
+ * - PREFIX :- every continuation line starts with LoggerConfig::continuation
+ * - ESCAPE :- \n, \r and \ are written as the escapes \n, \r and \\ so each
+ *             record is exactly one line
+ */
+enum class multiline_t { RAW, PREFIX, ESCAPE };
+
+struct LoggerConfig {
+  std::string name;
+  uint16_t port = 0;
+  // syslog listeners on a UDP port, a TCP port and a unix datagram socket,
+  // 0 or empty for none, see parse_syslog
+  uint16_t syslog_udp = 0;
+  uint16_t syslog_tcp = 0;
+  std::string syslog_unix;
+  // HTTP bulk ingest port, 0 for none
+  uint16_t http = 0;
+
+  write_mode_t write_mode = write_mode_t::APPEND;
+  // granularity of fadvise ranges and size of each O_DIRECT buffer, must be a
+  // multiple of 4096
+  size_t block_size = 1 << 20;
+  // size of each preallocated, mapped region in MMAP mode, a multiple of 4096
+  size_t segment_size = 64 << 20;
+  // rotate the output to <name>.<seq> once it would exceed this, 0 never
+  size_t rotate_size = 0;
+  // bytes the rotated segments may take up, 0 unlimited, see Retention
+  size_t disk_budget = 0;
+  // frame every append to the output with a crc32c in <name>.crc, see
+  // LogWriter
+  bool checksum = false;
+  // where the batch and O_DIRECT buffers get their pages from
+  hugepage_t hugepages = hugepage_t::OFF;
+  // records are formatted into a batch of this size and written together
+  // once it fills or the queue drains
+  size_t batch_size = 1 << 20;
+
+  // SO_RCVBUF / SO_SNDBUF for accepted connections, 0 keeps the kernel default
+  int rcvbuf = 0;
+  int sndbuf = 0;
+  // SO_BUSY_POLL microseconds for accepted connections, 0 disables
+  int busy_poll = 0;
+
+  // the most a connection is read per wakeup before the others get a turn
+  size_t read_budget = 64 << 10;
+  size_t record_budget = 64;
+
+  // close connections idle for this many seconds, 0 never
+  long idle_timeout = 0;
+
+  // layout of each output line, see LineFormat
+  std::string line_format = "{prefix}{message}";
+  multiline_t multiline = multiline_t::RAW;
+  // leading whitespace is what most line based tools take as "continues the
+  // previous line"
+  std::string continuation = "\t";
+
+  // secrets scrubbed from every message and its fields, see Redactor
+  std::vector<std::string> redact;
+
+  // how many of the noisiest statements to track, 0 disables, see TopTalkers
+  size_t top_k = 0;
+  // name:levels:count/seconds[:text] rules and the hooks they fire, see
+  // AlertRules
+  std::vector<std::string> alerts;
+  std::string alert_exec;
+  std::string alert_fifo;
+  // lines per level per source per second, see Rollups
+  bool rollups = false;
+  // milliseconds DEBUG and TRACE records of a trace are held waiting for an
+  // error, 0 disables, and the most they may take up, see TailSampler
+  uint64_t tail_window = 0;
+  size_t tail_budget = 64 << 20;
+  // path of the unix socket answering control commands, empty for none
+  std::string control;
+  // sidecar of mined message templates, empty disables mining, see
+  // TemplateMiner
+  std::string templates;
+  // also write <name>.arc, see ArchiveWriter
+  bool archive = false;
+  // compress the archive's chunks with zstd, see Compressor
+  bool compress = false;
+  // recompress sealed archives in the background, see Recompressor
+  bool recompress = false;
+};
+
+#endif // _LOGCONFIG_H
@@ -0,0 +1,93 @@
+#ifndef _LOGFORMAT_H
+#define _LOGFORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "fastfmt.hpp"
+#include "logconfig.hpp"
+#include "logrecord.hpp"
+
+/**
+ * the layout of an output line, written as literal text with these
+ * placeholders
+ * - {time}    :- receive time as 2024-07-09T12:00:00.000Z
+ * - {level}   :- level name, e.g. info
+ * - {prefix}  :- level prefix, e.g. "Info: "
+ * - {source}  :- sender name or address
+ * - {pid}     :- sender pid, - if unknown
+ * - {message} :- the message
+ * - {fields}  :- remaining key=value pairs from the header
+ * - {trace}   :- trace id as 32 hex digits, - if unknown
+ * - {span}    :- span id as 16 hex digits, - if unknown
+ * - {template} :- id of the message's template, 0 without one (see
+ *                 TemplateMiner)
+ * - {params}  :- the message's tokens in its template's wildcards, or the
+ *                message itself without a template
+ * - {{ / }}   :- a literal brace
+ *
+ * the template is parsed once into a flat list of steps, literal text between
+ * placeholders is kept as precomputed slices of one string
+ *
+ * newlines inside {message} are handled according to multiline, a trailing
+ * newline is dropped unless it is RAW
+ */
+class LineFormat {
+public:
+  LineFormat(const std::string &spec, multiline_t multiline = multiline_t::RAW,
+             const std::string &continuation = "");
+
+  /**
+   * an upper bound on the bytes format will write for record
+   */
+  size_t measure(const LogRecord &record) const;
+
+  /**
+   * writes record to out, which must have room for measure(record) bytes
+   *
+   * returns one past the last byte written
+   */
+  char *format(const LogRecord &record, char *out);
+
+private:
+  enum class op_t : uint8_t {
+    LITERAL,
+    TIME,
+    LEVEL,
+    PREFIX,
+    SOURCE,
+    PID,
+    MESSAGE,
+    FIELDS,
+    TRACE,
+    SPAN,
+    TEMPLATE,
+    PARAMS
+  };
+
+  struct step_t {
+    op_t op;
+    // LITERAL: slice of literals
+    uint32_t offset;
+    uint32_t len;
+  };
+
+  std::vector<step_t> steps;
+  std::string literals;
+  // literal bytes plus the worst case of every fixed width placeholder
+  size_t fixed_len;
+  DateCache dates;
+
+  multiline_t multiline;
+  std::string continuation;
+
+  void pushLiteral(const std::string &text);
+
+  size_t measureMessage(const std::string &message) const;
+
+  char *formatMessage(const std::string &message, char *out) const;
+};
+
+#endif // _LOGFORMAT_H
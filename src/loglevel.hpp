@@ -1,12 +1,51 @@
 #ifndef _LOGLEVEL_H
 #define _LOGLEVEL_H
 
+#include <cstddef>
 #include <cstdint>
 
-#define log_t uint8_t
-#define HEADER 0
-#define INFO 1
-#define DEBUG 2
-#define ERROR 3
+/**
+ * the numeric values are what goes over the wire, so new levels are only ever
+ * appended, severity ordering lives in LEVELS
+ */
+enum log_t : uint8_t {
+  HEADER = 0,
+  INFO = 1,
+  DEBUG = 2,
+  ERROR = 3,
+  TRACE = 4,
+  WARN = 5,
+  FATAL = 6,
+  LOG_LEVELS
+};
+
+constexpr size_t cstrlen(const char *s) { return *s ? 1 + cstrlen(s + 1) : 0; }
+
+struct level_info_t {
+  const char *name;
+  const char *prefix;
+  size_t prefix_len;
+  const char *colour;
+  size_t colour_len;
+  // TRACE lowest to FATAL highest, HEADER above everything so it is never
+  // filtered
+  uint8_t severity;
+};
+
+#define LEVEL_INFO(name, prefix, colour, severity)                             \
+  { name, prefix, cstrlen(prefix), colour, cstrlen(colour), severity }
+
+constexpr level_info_t LEVELS[LOG_LEVELS] = {
+    LEVEL_INFO("header", "", "\e[0m", 6),
+    LEVEL_INFO("info", "Info: ", "\e[0;36m", 2),
+    LEVEL_INFO("debug", "Debug: ", "\e[0;93m", 1),
+    LEVEL_INFO("error", "Error: ", "\e[0;91m", 4),
+    LEVEL_INFO("trace", "Trace: ", "\e[0;90m", 0),
+    LEVEL_INFO("warn", "Warn: ", "\e[0;33m", 3),
+    LEVEL_INFO("fatal", "Fatal: ", "\e[1;91m", 5),
+};
+
+#define COLOUR_RESET "\e[0m"
+#define COLOUR_RESET_LEN cstrlen(COLOUR_RESET)
 
 #endif // _LOGLEVEL_H
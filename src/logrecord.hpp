@@ -0,0 +1,31 @@
+#ifndef _LOGRECORD_H
+#define _LOGRECORD_H
+
+#include <cstdint>
+#include <string>
+
+#include "trace.hpp"
+
+/**
+ * a log as it travels from the connection that sent it to the writer
+ */
+struct LogRecord {
+  uint8_t level;
+  // when the logger received it, nanoseconds since the epoch
+  uint64_t time;
+  // sender's pid, 0 if it didn't say
+  uint32_t pid;
+  // sender's name, or its address if it didn't give one
+  std::string source;
+  // any other key=value pairs from the header, space separated
+  std::string fields;
+  std::string message;
+  // filled in by the TemplateMiner when template mining is on, 0 if the
+  // message has no template, see LineFormat {template} / {params}
+  uint32_t template_id = 0;
+  std::string params;
+  // from the trace= and span= fields, all zeros if the sender didn't say
+  trace_context_t trace = {};
+};
+
+#endif // _LOGRECORD_H
@@ -8,12 +8,112 @@
  * corrupting the log.
  *
  * [Format]
- * ./logger [name | STDOUT] [port]
+ * ./logger [name | STDOUT] [port] [options...]
  *
  * [Specification]
  * - name :- The name of the file to which the log should be output
  * - port :- The port which will be accepting log requests
  *
+ * [Options]
+ * - --write-mode=append|fadvise|direct|mmap :- how the file sink writes
+ *   (default append), fadvise drops written blocks from the page cache,
+ *   direct uses O_DIRECT with double-buffered blocks, mmap copies into
+ *   preallocated mapped segments
+ * - --block-size=bytes :- fadvise range / O_DIRECT buffer size, a multiple of
+ *   4096 (default 1MiB)
+ * - --segment-size=bytes :- preallocation / mapping unit in mmap mode, a
+ *   multiple of 4096 (default 64MiB)
+ * - --rotate-size=bytes :- rotate the output to <name>.<seq> before it grows
+ *   past this size (default 0, never)
+ * - --disk-budget=bytes :- keep the rotated segments and their sidecars
+ *   within this many bytes, less one --rotate-size for the segment being
+ *   written, by deleting the oldest DEBUG/TRACE only segments first, then
+ *   cutting segments down to their archives, then deleting the oldest
+ *   (default 0, unlimited)
+ * - --checksum=on|off :- record a crc32c of every write to the output in
+ *   <name>.crc, rotated with it, so logverify can find torn or corrupted
+ *   writes (default off)
+ * - --hugepages=off|thp|explicit :- back the batch and O_DIRECT buffers with
+ *   transparent or reserved huge pages (default off), buffers are always
+ *   prefaulted at startup
+ * - --batch-size=bytes :- formatted records are gathered into a batch of
+ *   this size before being handed to the writer (default 1MiB)
+ * - --rcvbuf=bytes, --sndbuf=bytes :- socket buffer sizes for log
+ *   connections (default kernel)
+ * - --busy-poll=usec :- SO_BUSY_POLL for log connections, trades CPU for
+ *   lower ingest latency (default 0, off)
+ * - --read-budget=bytes, --record-budget=count :- the most a single
+ *   connection is read per wakeup before the next one gets a turn (default
+ *   64KiB / 64 records)
+ * - --line-format=template :- layout of each output line, see LineFormat for
+ *   the placeholders (default "{prefix}{message}")
+ * - --multiline=raw|prefix|escape :- how newlines inside a message are
+ *   written (default raw), prefix starts every continuation line with the
+ *   --continuation text (default a tab), escape writes them as \n so every
+ *   record stays on one line
+ * - --redact=pattern, --redact-file=path :- scrub a secret from every record
+ *   before it is written, literal text or literal* to hide the value after
+ *   it (e.g. --redact=password=*), \ escapes a byte and regex syntax is
+ *   refused, the file holds one pattern per line, both may be repeated
+ * - --top-k=count :- track the count noisiest statements (source plus message
+ *   with numbers masked) in constant memory (default 0, off)
+ * - --control=path :- answer control commands on a unix socket at path
+ * - --templates=path :- mine a template for every message, kept in the
+ *   sidecar file at path, so lines can be written as {template} {params}
+ *   rather than {message} (whitespace runs in the message collapse to one
+ *   space)
+ * - --archive=on|off :- also write records to <name>.arc, a block encoded
+ *   archive that logsearch can filter by time, level and text without
+ *   decoding every block, sealed as <segment>.arc on rotation (default off,
+ *   best combined with --templates)
+ * - --compress=on|off :- compress the archive's blocks with zstd and a
+ *   dictionary trained in the background on recent blocks, needs a build with
+ *   zstd (default off)
+ * - --recompress=on|off :- once rotated, recompress each archive at a high
+ *   zstd level with a dictionary trained on all of it, on a background thread
+ *   at idle cpu and io priority, replacing the archive atomically (default
+ *   off)
+ * - --rollups=on|off :- count the lines of each level from each source every
+ *   second, appended once the second is over to <name>.rollup (see
+ *   rollup_header_t) and kept for the rollups control command (default off)
+ * - --alert=name:levels:count/seconds[:text] :- fire the alert hook once
+ *   count records of one of levels (e.g. error,fatal, or *) whose message
+ *   contains text arrive within seconds, then stay quiet for that long, see
+ *   AlertRules, may be repeated
+ * - --alert-exec=command :- run command with /bin/sh when an alert fires,
+ *   with ALERT_NAME, ALERT_COUNT, ALERT_WINDOW, ALERT_TIME, ALERT_LEVEL,
+ *   ALERT_SOURCE and ALERT_MESSAGE set
+ * - --alert-fifo=path :- write "<second> <name> <count> <level> <source>:
+ *   <message>" to the FIFO at path when an alert fires, created if needed,
+ *   alerts are dropped while nothing reads it (without a hook, alerts go to
+ *   stderr)
+ * - --tail-window=ms :- hold the DEBUG and TRACE records of each trace for
+ *   this long after its first record and write them only if the trace logs
+ *   an ERROR or FATAL in that time, see TailSampler (default 0, off)
+ * - --tail-budget=bytes :- the most memory held records may take up, past it
+ *   the oldest traces are dropped early (default 64MiB)
+ * - --syslog-udp=port, --syslog-tcp=port, --syslog-unix=path :- also accept
+ *   syslog messages (RFC 5424 or 3164) as UDP datagrams, over TCP framed by
+ *   newlines or octet counts (RFC 6587), or as datagrams on a unix socket
+ *   such as /dev/log, see parse_syslog for how they become records
+ * - --http=port :- also accept records in bulk as HTTP/1.1 POSTs, see [HTTP]
+ * - --idle-timeout=seconds :- close connections that have sent nothing for
+ *   this long (default 0, never)
+ *
+ * [Signals]
+ * - SIGUSR1 :- print every connection and the memory it holds to stderr
+ *
+ * [Control]
+ * Each connection to the control socket sends one command line and receives
+ * the reply, e.g. echo top | nc -U <path>
+ * - top         :- the noisiest statements as "<count> <error> <key>", the
+ *                  true count is between count - error and count
+ * - connections :- the same report as SIGUSR1
+ * - templates   :- the most common templates as "<id> <count> <template>"
+ * - rollups     :- the last minute as "<second> <level> <lines> <source>"
+ * - traces      :- records held by --tail-window and how many were kept and
+ *                  dropped
+ *
  * [Warnings]
  * This program is built to terminate upon any undefined situation, so it is
  * critical that the the process is called properlly and that the port is
@@ -21,14 +121,41 @@
  *
  * [Use]
  *   [Log Format]
- *   <level>:<message>
- *   - level   :- one of INFO, DEBUG, ERROR (will determine colour in STDOUT
- * [blue, yellow, red])
+ *   <level>[,pid=<pid>][,src=<name>][,trace=<id>][,span=<id>]
+ *   [,<key>=<value>...]:<message>\0
+ *   a connection may carry any number of NUL terminated logs, a log cut
+ *   short by the client closing the connection is still accepted, one
+ *   longer than 1MiB closes the connection
+ *   - level   :- the numeric log_t, one of INFO, DEBUG, ERROR, TRACE, WARN,
+ * FATAL (will determine prefix and colour in STDOUT, see LEVELS), unknown
+ * levels are counted and dropped
+ *   - pid     :- the sender's pid, printed by {pid}
+ *   - src     :- the sender's name, printed by {source} (defaults to its
+ * address)
+ *   - trace   :- W3C trace id, 32 hex digits, printed by {trace}
+ *   - span    :- W3C span id, 16 hex digits, printed by {span}
+ *   - key     :- any other fields, printed by {fields}, values can't contain
+ * ',' or ':'
  *   - message :- the arbitrary message to be printed
+ *
+ *   [HTTP]
+ *   with --http=port, POST to any path a body of records in the format
+ *   above, separated by newlines instead of NULs (a trailing \r is dropped),
+ *   with a Content-Length, chunked bodies aren't supported. connections are
+ *   kept alive as HTTP/1.1 has them and requests may be pipelined
+ *   - 204 :- every record was accepted
+ *   - 400 :- the body says how many records didn't parse, the rest were
+ *   accepted
+ *   - 405, 411, 431, 501, 505 :- the request was refused and the connection
+ *   closed
+ *   - 413 :- a record line was longer than 1MiB, the records before it were
+ *   accepted and the connection closed
+ *   e.g. curl --data-binary @records.txt http://localhost:<port>/
  */
 
 #include <arpa/inet.h>
 #include <asm-generic/socket.h>
+#include <atomic>
 #include <cassert>
 #include <cerrno>
 #include <climits>
@@ -37,27 +164,106 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <fcntl.h>
 #include <iostream>
 #include <mutex>
 #include <queue>
 #include <string>
+#include <string_view>
+#include <strings.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <thread>
 #include <unistd.h>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
+#include "alert.hpp"
+#include "archive.hpp"
+#include "drain.hpp"
+#include "hugepage.hpp"
+#include "logconfig.hpp"
+#include "logformat.hpp"
 #include "loglevel.hpp"
+#include "logrecord.hpp"
+#include "logwriter.hpp"
+#include "redact.hpp"
+#include "retention.hpp"
+#include "rollup.hpp"
+#include "syslog.hpp"
+#include "tail.hpp"
+#include "timerwheel.hpp"
+#include "topk.hpp"
 
 #define STDOUT STDOUT_FILENO
 
 #define port_t uint16_t
 #define fd_t ssize_t
 
+#define MAX_EVENTS 256
+#define IDLE_WHEEL_SLOTS 64
+// longest control command accepted
+#define CONTROL_MAX 4096
+// longest NUL terminated record accepted, the same as a syslog frame
+#define RECORD_MAX SYSLOG_FRAME_MAX
+// syslog datagrams received per recvmmsg and the longest kept whole, longer
+// ones are cut short
+#define SYSLOG_BATCH 32
+#define SYSLOG_DATAGRAM_MAX 8192
+// longest HTTP request line and headers accepted
+#define HTTP_HEADER_MAX 8192
+// longest record line accepted in an HTTP body, the same as a syslog frame
+#define HTTP_LINE_MAX SYSLOG_FRAME_MAX
+
+/**
+ * set by SIGUSR1, asks the event loop to print connectionReport to stderr
+ */
+extern volatile sig_atomic_t report_requested;
+
+uint64_t realtime_nanoseconds();
+
+time_t monotonic_seconds();
+
+/**
+ * what a connection carries, decided by the port it came in on
+ * - NATIVE :- NUL terminated records
+ * - SYSLOG :- syslog frames, see syslog_frame
+ * - HTTP   :- POST requests whose bodies are newline separated records
+ */
+enum class protocol_t { NATIVE, SYSLOG, HTTP };
+
+/**
+ * a client connection, which may carry any number of records
+ */
+struct Connection {
+  fd_t fd;
+  // bytes of a record whose terminating NUL hasn't arrived yet
+  std::string pending;
+  // whether fd is already waiting in Logger::ready
+  bool queued;
+  // unique across fd reuse, so stale timer wheel entries can be recognised
+  uint64_t id;
+  time_t last_active;
+  struct sockaddr_in peer;
+  // source of records that don't name one
+  std::string peer_name;
+  protocol_t protocol;
+  // HTTP only: body bytes of the current request still to come, 0 while
+  // its headers are being read
+  size_t body_left;
+  bool keep_alive;
+  // records of the current request that didn't parse
+  size_t invalid;
+};
+
 class Logger {
 public:
-  Logger(std::string name, port_t port);
+  Logger(LoggerConfig config);
 
   void start();
 
@@ -66,25 +272,208 @@ public:
   ~Logger();
 
 private:
-  ssize_t file;
+  LogWriter writer;
+  LineFormat line_format;
+  Redactor redactor;
+  char *batch;
+  size_t batch_len;
+  size_t batch_size;
+  // levels (bit 1 << level) of the records in batch and of the records
+  // already appended to the current segment
+  uint32_t batch_levels;
+  uint32_t segment_levels;
   fd_t sock;
+  fd_t epoll;
   struct sockaddr_in addr;
-  std::queue<std::pair<uint8_t, std::string>> logqueue;
+  int busy_poll;
+
+  std::unordered_map<fd_t, Connection> connections;
+  // connections with unread data, serviced round robin
+  std::deque<fd_t> ready;
+  size_t read_budget;
+  size_t record_budget;
+
+  time_t idle_timeout;
+  uint64_t next_id;
+  TimerWheel idle_wheel;
+
+  std::atomic<uint64_t> unknown_levels;
+
+  TopTalkers talkers;
+  // key of the record being counted, reused by the queue thread
+  std::string talker;
+  Rollups rollups;
+  AlertRules alerts;
+  TailSampler tail;
+  // records tail released, reused by the queue thread
+  std::vector<LogRecord> released;
+  TemplateMiner miner;
+  ArchiveWriter archive;
+  Retention retention;
+
+  fd_t control;
+  fd_t syslog_udp;
+  fd_t syslog_tcp;
+  fd_t syslog_unix;
+  fd_t http;
+  // SYSLOG_BATCH buffers for datagrams
+  std::vector<char> datagrams;
+  // syslog records waiting to be queued together, reused by the event loop
+  std::vector<LogRecord> received;
+  // control connections and the part of their command read so far
+  std::unordered_map<fd_t, std::string> controls;
+
+  std::queue<LogRecord> logqueue;
   std::mutex logqueuelock;
 
+  /**
+   * accepts every pending connection on listener, sock, syslog_tcp or http,
+   * and registers it with epoll
+   */
+  void acceptConnections(fd_t listener);
+
+  /**
+   * queues fd for servicing unless it is already queued
+   */
+  void markReady(fd_t fd);
+
+  void serviceReady();
+
+  /**
+   * reads from conn until it would block or its read budget is spent
+   *
+   * returns true if the budget ran out, meaning conn may still be readable
+   */
+  bool serviceConnection(Connection &conn);
+
+  /**
+   * parses a <level>[,key=value...]:<message> record from conn and pushes it
+   * onto logqueue
+   *
+   * returns false if the record is malformed
+   */
+  bool parseRecord(Connection &conn, const char *record, size_t len);
+
+  /**
+   * parses every complete frame of the len bytes just read from a syslog
+   * connection into data, keeping a partial one in conn.pending
+   *
+   * returns false if the stream is malformed
+   */
+  bool splitSyslog(Connection &conn, const char *data, size_t len,
+                   size_t &records);
+
+  /**
+   * the record for a syslog message received at time, peer is its source if
+   * the message doesn't name one
+   */
+  LogRecord syslogRecord(std::string_view data, const char *peer,
+                         uint64_t time);
+
+  /**
+   * reads up to a record budget of datagrams from syslog_udp or syslog_unix
+   */
+  void serviceDatagrams(fd_t fd);
+
+  /**
+   * parses the len bytes just read from an HTTP connection into data, each
+   * body line straight from data into a record, keeping a partial request
+   * line, headers or body line in conn.pending
+   *
+   * returns false if the connection is to be closed
+   */
+  bool splitHttp(Connection &conn, const char *data, size_t len,
+                 size_t &records);
+
+  /**
+   * parses the request line and headers in [head, head + len), each line
+   * ending in \r\n, and readies conn for the body
+   *
+   * returns 0, or the status to refuse the request with
+   */
+  int parseHttpRequest(Connection &conn, const char *head, size_t len);
+
+  /**
+   * answers the request whose body was just read
+   *
+   * returns false if the connection is to be closed
+   */
+  bool finishHttp(Connection &conn);
+
+  /**
+   * writes a response with status and a plain text body to conn, returns
+   * false if it couldn't be sent whole
+   */
+  bool respondHttp(Connection &conn, int status, const char *body);
+
+  void closeConnection(fd_t fd);
+
+  /**
+   * listens for control connections on a unix socket at path, replacing a
+   * socket left behind by an earlier run
+   */
+  void openControl(const std::string &path);
+
+  /**
+   * opens the syslog and HTTP listeners config asks for, terminating if one
+   * can't be
+   */
+  void openListeners(const LoggerConfig &config);
+
+  void acceptControl();
+
+  /**
+   * reads a control command from fd, once the whole line has arrived it is
+   * answered and fd closed
+   */
+  void serviceControl(fd_t fd);
+
+  std::string controlCommand(const std::string &command);
+
+  void reapIdle();
+
+  size_t connectionMemory(const Connection &conn);
+
+  /**
+   * one line per connection with its peer, idle time and memory, preceded by
+   * a summary line
+   */
+  std::string connectionReport();
+
   /**
    * threadsafe method to add an element to logqueue
    */
-  void pushQueue(std::pair<uint8_t, std::string> log);
+  void pushQueue(LogRecord log);
+
+  /**
+   * threadsafe method to add every element of logs to logqueue under one
+   * lock, leaving logs empty
+   */
+  void pushQueue(std::vector<LogRecord> &logs);
 
   /**
    * threadsafe method to extract the first element from the queue, then
    * remove it from logqueue..
    */
-  std::pair<uint8_t, std::string> popQueue();
+  LogRecord popQueue();
+
+  /**
+   * formats the log into the batch with line_format and its LEVELS entry,
+   * logs with an unknown level are counted in unknown_levels and dropped
+   */
+  void commitLog(const LogRecord &log);
+
+  /**
+   * claims len bytes at the end of the batch, committing the batch first if
+   * they don't fit
+   *
+   * returns nullptr if len is larger than the whole batch
+   */
+  char *reserveBatch(size_t len);
 
   /**
-   * writes the log to the designated file
+   * hands the batch to the writer as a single append, followed by the archive
+   * chunk of the same records
    */
-  void commitLog(uint8_t level, std::string message);
+  void commitBatch();
 };
@@ -0,0 +1,136 @@
+#ifndef _LOGWRITER_H
+#define _LOGWRITER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+
+#include "logconfig.hpp"
+
+#define CHECKSUM_SUFFIX ".crc"
+
+/**
+ * one entry of <segment>.crc per append: the crc32c of the len bytes written
+ * at offset. frames are written after their bytes but not synced with them,
+ * so after a crash either may be missing or torn
+ */
+struct checksum_frame_t {
+  uint64_t offset;
+  uint32_t len;
+  uint32_t crc;
+};
+
+/**
+ * the file sink of the Logger, owns the output descriptor and decides how
+ * bytes reach the disk (see write_mode_t)
+ */
+class LogWriter {
+public:
+  LogWriter(const LoggerConfig &config);
+
+  /**
+   * appends a complete record to the sink, records are never split between
+   * two write calls in APPEND/FADVISE mode or between two segments
+   */
+  void append(const char *buf, size_t len);
+
+  /**
+   * hands any buffered bytes to the kernel, called whenever the log queue
+   * drains so a quiet logger never sits on unwritten records
+   */
+  void flush();
+
+  /**
+   * closes the current file, renames it to <name>.<seq> and starts a new one
+   */
+  void rotate();
+
+  /**
+   * hook called with the new name of each rotated segment
+   */
+  void onRotate(std::function<void(const std::string &)> hook);
+
+  bool is_stdout() const;
+
+  ~LogWriter();
+
+private:
+  std::string name;
+  ssize_t file;
+  write_mode_t mode;
+  size_t block_size;
+  size_t segment_size;
+  size_t rotate_size;
+  hugepage_t hugepages;
+  unsigned long seq;
+  std::function<void(const std::string &)> rotate_hook;
+
+  bool checksum;
+  // <name>.crc if checksum is set, else -1
+  ssize_t frames;
+
+  // logical size of the current file
+  off_t size;
+
+  // FADVISE: [dropped, synced) has been queued for writeback, [synced, size)
+  // is still only in the page cache
+  off_t synced;
+  off_t dropped;
+
+  // DIRECT: blocks[active] is being filled at file offset block_off, the
+  // other block may be in flight on the flusher thread
+  char *blocks[2];
+  int active;
+  size_t fill;
+  off_t block_off;
+  bool dirty;
+
+  std::thread flusher;
+  std::mutex flushlock;
+  std::condition_variable flushcv;
+  bool inflight;
+  char *inflight_block;
+  off_t inflight_off;
+  bool stopping;
+
+  // MMAP: the fallocated segment [map_off, map_off + segment_size) is mapped
+  // at map, everything before committed has been msynced
+  char *map;
+  off_t map_off;
+  off_t committed;
+
+  void openFile();
+
+  void closeFile();
+
+  void openFrames();
+
+  void openDirect();
+
+  void advise();
+
+  void directAppend(const char *buf, size_t len);
+
+  /**
+   * body of the flusher thread, writes out full blocks handed over by
+   * directAppend so the queue thread can keep filling the other block
+   */
+  void flushBlocks();
+
+  void waitFlusher();
+
+  void openMapped();
+
+  void mapSegment(off_t off);
+
+  void unmapSegment();
+
+  void mappedAppend(const char *buf, size_t len);
+};
+
+#endif // _LOGWRITER_H
@@ -1,6 +1,9 @@
 #include "logserver.hpp"
 
+#include <fstream>
+
 port_t get_port(char *port_string) {
+  errno = 0;
   long port = strtol(port_string, NULL, 10);
 
   assert(errno == 0);
@@ -9,20 +12,206 @@ port_t get_port(char *port_string) {
   return port;
 }
 
+size_t get_size(const char *size_string) {
+  char *end;
+  errno = 0;
+  unsigned long long size = strtoull(size_string, &end, 10);
+
+  assert(errno == 0);
+  assert(end != size_string && *end == '\0');
+
+  return size;
+}
+
+/**
+ * applies a single --key=value option to config, terminating on anything it
+ * doesn't understand
+ */
+void parse_option(LoggerConfig &config, char *option) {
+  std::string opt(option);
+  size_t eq = opt.find('=');
+  if (opt.rfind("--", 0) != 0 || eq == std::string::npos) {
+    fprintf(stderr, "invalid option %s\n", option);
+    exit(EXIT_FAILURE);
+  }
+
+  std::string key = opt.substr(2, eq - 2);
+  std::string value = opt.substr(eq + 1);
+
+  if (key == "write-mode") {
+    if (value == "append") {
+      config.write_mode = write_mode_t::APPEND;
+    } else if (value == "fadvise") {
+      config.write_mode = write_mode_t::FADVISE;
+    } else if (value == "direct") {
+      config.write_mode = write_mode_t::DIRECT;
+    } else if (value == "mmap") {
+      config.write_mode = write_mode_t::MMAP;
+    } else {
+      fprintf(stderr, "unknown write mode %s\n", value.c_str());
+      exit(EXIT_FAILURE);
+    }
+  } else if (key == "syslog-udp") {
+    config.syslog_udp = get_port(&value[0]);
+  } else if (key == "syslog-tcp") {
+    config.syslog_tcp = get_port(&value[0]);
+  } else if (key == "syslog-unix") {
+    config.syslog_unix = value;
+  } else if (key == "http") {
+    config.http = get_port(&value[0]);
+  } else if (key == "block-size") {
+    config.block_size = get_size(value.c_str());
+  } else if (key == "segment-size") {
+    config.segment_size = get_size(value.c_str());
+  } else if (key == "rotate-size") {
+    config.rotate_size = get_size(value.c_str());
+  } else if (key == "disk-budget") {
+    config.disk_budget = get_size(value.c_str());
+  } else if (key == "checksum") {
+    if (value == "on") {
+      config.checksum = true;
+    } else if (value == "off") {
+      config.checksum = false;
+    } else {
+      fprintf(stderr, "checksum must be on or off\n");
+      exit(EXIT_FAILURE);
+    }
+  } else if (key == "hugepages") {
+    if (value == "off") {
+      config.hugepages = hugepage_t::OFF;
+    } else if (value == "thp") {
+      config.hugepages = hugepage_t::TRANSPARENT;
+    } else if (value == "explicit") {
+      config.hugepages = hugepage_t::EXPLICIT;
+    } else {
+      fprintf(stderr, "unknown huge page policy %s\n", value.c_str());
+      exit(EXIT_FAILURE);
+    }
+  } else if (key == "batch-size") {
+    config.batch_size = get_size(value.c_str());
+  } else if (key == "rcvbuf") {
+    config.rcvbuf = get_size(value.c_str());
+  } else if (key == "sndbuf") {
+    config.sndbuf = get_size(value.c_str());
+  } else if (key == "busy-poll") {
+    config.busy_poll = get_size(value.c_str());
+  } else if (key == "read-budget") {
+    config.read_budget = get_size(value.c_str());
+  } else if (key == "record-budget") {
+    config.record_budget = get_size(value.c_str());
+  } else if (key == "line-format") {
+    config.line_format = value;
+  } else if (key == "multiline") {
+    if (value == "raw") {
+      config.multiline = multiline_t::RAW;
+    } else if (value == "prefix") {
+      config.multiline = multiline_t::PREFIX;
+    } else if (value == "escape") {
+      config.multiline = multiline_t::ESCAPE;
+    } else {
+      fprintf(stderr, "unknown multiline mode %s\n", value.c_str());
+      exit(EXIT_FAILURE);
+    }
+  } else if (key == "continuation") {
+    config.continuation = value;
+  } else if (key == "redact") {
+    config.redact.push_back(value);
+  } else if (key == "redact-file") {
+    std::ifstream file(value);
+    if (!file) {
+      perror("couldn't open redaction patterns");
+      exit(EXIT_FAILURE);
+    }
+    std::string pattern;
+    while (std::getline(file, pattern)) {
+      if (!pattern.empty()) {
+        config.redact.push_back(pattern);
+      }
+    }
+  } else if (key == "top-k") {
+    config.top_k = get_size(value.c_str());
+  } else if (key == "alert") {
+    config.alerts.push_back(value);
+  } else if (key == "alert-exec") {
+    config.alert_exec = value;
+  } else if (key == "alert-fifo") {
+    config.alert_fifo = value;
+  } else if (key == "rollups") {
+    if (value == "on") {
+      config.rollups = true;
+    } else if (value == "off") {
+      config.rollups = false;
+    } else {
+      fprintf(stderr, "rollups must be on or off\n");
+      exit(EXIT_FAILURE);
+    }
+  } else if (key == "tail-window") {
+    config.tail_window = get_size(value.c_str());
+  } else if (key == "tail-budget") {
+    config.tail_budget = get_size(value.c_str());
+  } else if (key == "control") {
+    config.control = value;
+  } else if (key == "templates") {
+    config.templates = value;
+  } else if (key == "archive") {
+    if (value == "on") {
+      config.archive = true;
+    } else if (value == "off") {
+      config.archive = false;
+    } else {
+      fprintf(stderr, "archive must be on or off\n");
+      exit(EXIT_FAILURE);
+    }
+  } else if (key == "compress") {
+    if (value == "on") {
+      config.compress = true;
+    } else if (value == "off") {
+      config.compress = false;
+    } else {
+      fprintf(stderr, "compress must be on or off\n");
+      exit(EXIT_FAILURE);
+    }
+  } else if (key == "recompress") {
+    if (value == "on") {
+      config.recompress = true;
+    } else if (value == "off") {
+      config.recompress = false;
+    } else {
+      fprintf(stderr, "recompress must be on or off\n");
+      exit(EXIT_FAILURE);
+    }
+  } else if (key == "idle-timeout") {
+    config.idle_timeout = get_size(value.c_str());
+  } else {
+    fprintf(stderr, "unknown option %s\n", key.c_str());
+    exit(EXIT_FAILURE);
+  }
+}
+
 Logger *logger;
 
 void sig_handler(int s) { exit(EXIT_SUCCESS); }
 
+void report_handler(int s) { report_requested = 1; }
+
 int main(int argc, char **argv) {
-  assert(argc == 3);
+  assert(argc >= 3);
 
-  std::string name(argv[1]);
-  port_t port = get_port(argv[2]);
+  LoggerConfig config;
+  config.name = argv[1];
+  config.port = get_port(argv[2]);
+  for (int i = 3; i < argc; i++) {
+    parse_option(config, argv[i]);
+  }
 
   signal(SIGINT, sig_handler);
   signal(SIGTERM, sig_handler);
   signal(SIGSEGV, sig_handler);
-  logger = new Logger(name, port);
+  signal(SIGUSR1, report_handler);
+  // an alert FIFO's reader may go away mid write
+  signal(SIGPIPE, SIG_IGN);
+
+  logger = new Logger(config);
 
   return 0;
 }
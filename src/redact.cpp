@@ -0,0 +1,158 @@
+/*
+ * Author: Elijah Mullens
+ * Date: 09/07/2024
+ */
+
+#include "redact.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+
+static bool is_value_end(char c) {
+  return isspace((unsigned char)c) || strchr(",;&\"'", c) != nullptr;
+}
+
+/**
+ * the bytes spec matches, setting value for a trailing *, terminating on
+ * anything that looks like a regex
+ */
+static std::string parse_pattern(const std::string &spec, bool &value) {
+  std::string literal;
+  value = false;
+  for (size_t i = 0; i < spec.size(); i++) {
+    char c = spec[i];
+    if (c == '\\' && i + 1 < spec.size()) {
+      literal += spec[++i];
+    } else if (c == '*' && i + 1 == spec.size()) {
+      value = true;
+    } else if (strchr("\\[]()|+?^${}*", c) != nullptr) {
+      fprintf(stderr,
+              "redaction pattern %s looks like a regex, only literal and "
+              "literal* are supported, \\ escapes a byte\n",
+              spec.c_str());
+      exit(EXIT_FAILURE);
+    } else {
+      literal += c;
+    }
+  }
+  return literal;
+}
+
+Redactor::Redactor(const std::vector<std::string> &specs) : columns(1) {
+  memset(classes, 0, sizeof(classes));
+  std::vector<std::string> literals;
+  for (const std::string &spec : specs) {
+    bool value;
+    literals.push_back(parse_pattern(spec, value));
+    const std::string &literal = literals.back();
+    if (literal.empty()) {
+      fprintf(stderr, "empty redaction pattern\n");
+      exit(EXIT_FAILURE);
+    }
+    patterns.push_back({(uint32_t)literal.size(), value});
+    for (char c : literal) {
+      if (classes[(uint8_t)c] == 0) {
+        classes[(uint8_t)c] = columns++;
+      }
+    }
+  }
+
+  // trie, 0 doubles as "no edge" since nothing points back at the root
+  next.assign(columns, 0);
+  match.assign(1, {0, false});
+  for (size_t p = 0; p < patterns.size(); p++) {
+    uint32_t state = 0;
+    for (char c : literals[p]) {
+      size_t edge = state * columns + classes[(uint8_t)c];
+      if (next[edge] == 0) {
+        next[edge] = match.size();
+        next.resize(next.size() + columns, 0);
+        match.push_back({0, false});
+      }
+      state = next[edge];
+    }
+    if (patterns[p].value) {
+      match[state].value = true;
+    } else {
+      match[state].len = patterns[p].len;
+    }
+  }
+
+  // breadth first, every missing edge borrows the edge of the failure state,
+  // which is already complete since it is shallower
+  std::vector<uint32_t> fail(match.size(), 0);
+  std::queue<uint32_t> order;
+  for (size_t c = 0; c < columns; c++) {
+    if (next[c] != 0) {
+      order.push(next[c]);
+    }
+  }
+  while (!order.empty()) {
+    uint32_t state = order.front();
+    order.pop();
+    // a suffix's literal is never longer than the state's own
+    const match_t &suffix = match[fail[state]];
+    match[state].len = std::max(match[state].len, suffix.len);
+    match[state].value |= suffix.value;
+
+    for (size_t c = 0; c < columns; c++) {
+      uint32_t &edge = next[state * columns + c];
+      uint32_t fallback = next[fail[state] * columns + c];
+      if (edge == 0) {
+        edge = fallback;
+      } else {
+        fail[edge] = fallback;
+        order.push(edge);
+      }
+    }
+  }
+}
+
+bool Redactor::empty() const { return patterns.empty(); }
+
+bool Redactor::apply(std::string &text) const {
+  if (patterns.empty()) {
+    return false;
+  }
+
+  std::string out;
+  // text[0, copied) has been written to out or masked
+  size_t copied = 0;
+  uint32_t state = 0;
+  for (size_t i = 0; i < text.size(); i++) {
+    state = next[state * columns + classes[(uint8_t)text[i]]];
+    const match_t &found = match[state];
+    size_t start = i + 1 - found.len;
+    size_t end = i + 1;
+    if (found.value) {
+      while (end < text.size() && !is_value_end(text[end])) {
+        end++;
+      }
+      if (end > i + 1) {
+        // the value is skipped, so matching starts over after it
+        i = end - 1;
+        state = 0;
+      }
+    }
+    if (end == start) {
+      continue;
+    }
+
+    if (start >= copied) {
+      out.append(text, copied, start - copied);
+      out += REDACTED_MASK;
+    }
+    copied = std::max(copied, end);
+  }
+
+  if (out.empty()) {
+    return false;
+  }
+  out.append(text, copied, std::string::npos);
+  text.swap(out);
+  return true;
+}
@@ -0,0 +1,65 @@
+#ifndef _REDACT_H
+#define _REDACT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define REDACTED_MASK "[REDACTED]"
+
+/**
+ * scrubs secrets out of records before they are formatted
+ *
+ * a pattern is either
+ * - literal  :- every occurrence of literal is replaced
+ * - literal* :- literal is kept and the value following it, up to whitespace
+ *               or one of ,;&"', is replaced, e.g. "password=*"
+ *
+ * a \ makes the next byte literal, e.g. "price\$", any other \[]()|+?^${} or
+ * a * before the end is taken as an attempt at a regex and refused at startup
+ *
+ * all patterns are compiled into one Aho-Corasick automaton, flattened into a
+ * DFA over only the bytes the patterns use, so each text is scanned once no
+ * matter how many patterns there are
+ */
+class Redactor {
+public:
+  Redactor(const std::vector<std::string> &patterns);
+
+  /**
+   * replaces every match in text with REDACTED_MASK, overlapping matches
+   * share one mask
+   *
+   * returns true if anything was replaced
+   */
+  bool apply(std::string &text) const;
+
+  bool empty() const;
+
+private:
+  struct pattern_t {
+    uint32_t len;
+    // literal*, the match is the value after the literal
+    bool value;
+  };
+
+  std::vector<pattern_t> patterns;
+
+  // byte -> column of the transition table, 0 for bytes no pattern contains
+  uint16_t classes[256];
+  size_t columns;
+  // next[state * columns + class], state 0 is the root
+  std::vector<uint32_t> next;
+  // what ends in a state, following suffix links, masked together as one
+  struct match_t {
+    // longest literal pattern, 0 if none
+    uint32_t len;
+    // some literal* pattern, they all mask the same value
+    bool value;
+  };
+
+  std::vector<match_t> match;
+};
+
+#endif // _REDACT_H
@@ -0,0 +1,130 @@
+/*
+ * Author: Elijah Mullens
+ * Date: 09/07/2024
+ */
+
+#include "retention.hpp"
+#include "archive.hpp"
+#include "logwriter.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <set>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t file_size(const std::string &path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+/**
+ * the levels in the archive at path from its chunk headers, every level if
+ * there's no archive to tell
+ */
+static uint32_t archive_levels(const std::string &path) {
+  ArchiveReader reader;
+  if (!reader.open(path)) {
+    return ~0u;
+  }
+
+  uint32_t levels = 0;
+  archive_header_t header;
+  while (reader.next(header)) {
+    levels |= header.levels;
+  }
+  return levels;
+}
+
+Retention::Retention(const std::string &name, size_t budget,
+                     size_t rotate_size)
+    : budget(budget), rotate_size(rotate_size), total(0) {
+  if (budget == 0) {
+    return;
+  }
+  if (name == "stdout" || rotate_size == 0 || budget <= rotate_size) {
+    fprintf(stderr, "a disk budget needs a log file and a smaller "
+                    "--rotate-size\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // the one scan of the directory, for <name>.<seq> and its sidecars
+  size_t slash = name.rfind('/');
+  std::string dir = slash == std::string::npos ? "." : name.substr(0, slash);
+  std::string prefix =
+      (slash == std::string::npos ? name : name.substr(slash + 1)) + ".";
+
+  std::set<unsigned long> seqs;
+  DIR *d = opendir(dir.c_str());
+  if (d != NULL) {
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+      if (strncmp(entry->d_name, prefix.c_str(), prefix.size()) != 0) {
+        continue;
+      }
+      const char *digits = entry->d_name + prefix.size();
+      char *suffix;
+      unsigned long seq = strtoul(digits, &suffix, 10);
+      if (*digits < '0' || *digits > '9' ||
+          (*suffix != '\0' && strcmp(suffix, CHECKSUM_SUFFIX) != 0 &&
+           strcmp(suffix, ARCHIVE_SUFFIX) != 0)) {
+        continue;
+      }
+      seqs.insert(seq);
+    }
+    closedir(d);
+  }
+
+  for (unsigned long seq : seqs) {
+    std::string path = name + "." + std::to_string(seq);
+    segments.push_back(
+        measure(path, archive_levels(path + ARCHIVE_SUFFIX)));
+    total += segments.back().log_bytes + segments.back().archive_bytes;
+  }
+  enforce();
+}
+
+bool Retention::enabled() const { return budget > 0; }
+
+Retention::segment_t Retention::measure(const std::string &path,
+                                        uint32_t levels) {
+  return {path, levels,
+          file_size(path) + file_size(path + CHECKSUM_SUFFIX),
+          file_size(path + ARCHIVE_SUFFIX)};
+}
+
+void Retention::sealed(const std::string &rotated, uint32_t levels) {
+  segments.push_back(measure(rotated, levels));
+  total += segments.back().log_bytes + segments.back().archive_bytes;
+  enforce();
+}
+
+void Retention::enforce() {
+  // first drop segments of only low levels, then downgrade segments to their
+  // archives, then drop whatever is left, oldest first each time
+  for (int pass = 0; pass < 3 && total + rotate_size > budget; pass++) {
+    auto it = segments.begin();
+    while (it != segments.end() && total + rotate_size > budget) {
+      bool low = (it->levels & ~RETENTION_LOW_LEVELS) == 0;
+      if ((pass == 0 && !low) ||
+          (pass == 1 && (it->log_bytes == 0 || it->archive_bytes == 0))) {
+        it++;
+        continue;
+      }
+
+      unlink(it->path.c_str());
+      unlink((it->path + CHECKSUM_SUFFIX).c_str());
+      total -= it->log_bytes;
+      it->log_bytes = 0;
+      if (pass == 1) {
+        it++;
+        continue;
+      }
+      unlink((it->path + ARCHIVE_SUFFIX).c_str());
+      total -= it->archive_bytes;
+      it = segments.erase(it);
+    }
+  }
+}
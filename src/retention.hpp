@@ -0,0 +1,61 @@
+#ifndef _RETENTION_H
+#define _RETENTION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+
+#include "loglevel.hpp"
+
+// levels a segment may hold and still be dropped before any other
+#define RETENTION_LOW_LEVELS                                                   \
+  ((1u << HEADER) | (1u << DEBUG) | (1u << TRACE))
+
+/**
+ * keeps the rotated segments of a log, with their .crc and .arc sidecars,
+ * within a disk budget that leaves room for one more segment of rotate_size
+ *
+ * the segments are found once at startup and after that only added as they
+ * are sealed, so the directory is never scanned again. while over budget,
+ * oldest first:
+ * - segments holding nothing above DEBUG are deleted
+ * - segments with an archive are downgraded to just the archive
+ * - any remaining segments are deleted
+ */
+class Retention {
+public:
+  /**
+   * retention is off if budget is 0
+   */
+  Retention(const std::string &name, size_t budget, size_t rotate_size);
+
+  bool enabled() const;
+
+  /**
+   * adds the segment just sealed as rotated, holding records of levels (bit
+   * 1 << level), and trims the log back to the budget
+   */
+  void sealed(const std::string &rotated, uint32_t levels);
+
+private:
+  struct segment_t {
+    std::string path;
+    uint32_t levels;
+    // the segment and its .crc, and its .arc
+    uint64_t log_bytes;
+    uint64_t archive_bytes;
+  };
+
+  size_t budget;
+  size_t rotate_size;
+  // oldest first
+  std::deque<segment_t> segments;
+  uint64_t total;
+
+  segment_t measure(const std::string &path, uint32_t levels);
+
+  void enforce();
+};
+
+#endif // _RETENTION_H
@@ -0,0 +1,167 @@
+/*
+ * Author: Elijah Mullens
+ * Date: 09/07/2024
+ */
+
+#include "rollup.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+Rollups::Rollups(const std::string &name, bool enabled)
+    : on(enabled), sidecar(nullptr), open_second(0), counts(nullptr) {
+  if (!on || name == "stdout") {
+    return;
+  }
+
+  std::string path = name + ROLLUP_SUFFIX;
+  load(path);
+  if ((sidecar = fopen(path.c_str(), "a")) == nullptr) {
+    perror("couldn't open rollup file");
+    exit(EXIT_FAILURE);
+  }
+  fseek(sidecar, 0, SEEK_END);
+  if (ftell(sidecar) == 0 &&
+      fwrite(ROLLUP_MAGIC, ROLLUP_MAGIC_LEN, 1, sidecar) != 1) {
+    perror("couldn't write rollup file");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void Rollups::load(const std::string &path) {
+  FILE *saved = fopen(path.c_str(), "r");
+  if (saved == nullptr) {
+    return;
+  }
+
+  char magic[ROLLUP_MAGIC_LEN];
+  if (fread(magic, ROLLUP_MAGIC_LEN, 1, saved) != 1 ||
+      memcmp(magic, ROLLUP_MAGIC, ROLLUP_MAGIC_LEN) != 0) {
+    fprintf(stderr, "%s isn't a rollup file\n", path.c_str());
+    exit(EXIT_FAILURE);
+  }
+
+  long end = ROLLUP_MAGIC_LEN;
+  rollup_header_t header;
+  std::string body;
+  while (fread(&header, sizeof(header), 1, saved) == 1) {
+    size_t len = header.kind == SOURCE ? header.count
+                                       : header.count * sizeof(rollup_entry_t);
+    body.resize(len);
+    if (len > 0 && fread(&body[0], len, 1, saved) != 1) {
+      break;
+    }
+    if (header.kind == SOURCE) {
+      ids.emplace(body, names.size());
+      names.push_back(body);
+    }
+    end = ftell(saved);
+  }
+  fclose(saved);
+
+  // so the next frame starts where the last whole one ended
+  if (truncate(path.c_str(), end) < 0) {
+    perror("couldn't trim rollup file");
+    exit(EXIT_FAILURE);
+  }
+}
+
+bool Rollups::enabled() const { return on; }
+
+void Rollups::add(const LogRecord &record) {
+  if (record.level == HEADER || record.level >= LOG_LEVELS) {
+    return;
+  }
+
+  // a record from before the open second, the clock having stepped back,
+  // is counted in it
+  uint64_t second = record.time / 1000000000ull;
+  if (second > open_second) {
+    close();
+    open_second = second;
+  }
+
+  if (counts == nullptr || record.source != last_source) {
+    counts = &open[record.source];
+    last_source = record.source;
+  }
+  (*counts)[record.level]++;
+}
+
+void Rollups::tick(uint64_t now) {
+  if (!open.empty() && now / 1000000000ull > open_second) {
+    close();
+  }
+}
+
+void Rollups::close() {
+  if (open.empty()) {
+    return;
+  }
+
+  closed_t closed = {open_second, {}};
+  std::string frames;
+  for (auto &entry : open) {
+    auto found = ids.find(entry.first);
+    uint32_t id;
+    if (found != ids.end()) {
+      id = found->second;
+    } else {
+      id = ids.size();
+      ids.emplace(entry.first, id);
+      rollup_header_t source = {SOURCE, {}, (uint32_t)entry.first.size(), 0};
+      frames.append((const char *)&source, sizeof(source));
+      frames += entry.first;
+      std::lock_guard<std::mutex> guard(lock);
+      names.push_back(entry.first);
+    }
+
+    for (uint8_t level = 0; level < LOG_LEVELS; level++) {
+      if (entry.second[level] != 0) {
+        closed.entries.push_back({id, entry.second[level], level, {}});
+      }
+    }
+  }
+  open.clear();
+  counts = nullptr;
+
+  if (sidecar != nullptr) {
+    rollup_header_t header = {SECOND, {}, (uint32_t)closed.entries.size(),
+                              closed.second};
+    frames.append((const char *)&header, sizeof(header));
+    frames.append((const char *)closed.entries.data(),
+                  closed.entries.size() * sizeof(rollup_entry_t));
+    if (fwrite(frames.data(), frames.size(), 1, sidecar) != 1 ||
+        fflush(sidecar) != 0) {
+      perror("couldn't write rollup file");
+    }
+  }
+
+  std::lock_guard<std::mutex> guard(lock);
+  history.push_back(std::move(closed));
+  if (history.size() > ROLLUP_HISTORY) {
+    history.pop_front();
+  }
+}
+
+std::string Rollups::report() {
+  std::lock_guard<std::mutex> guard(lock);
+  std::string out =
+      "rollups " + std::to_string(history.size()) + " seconds\n";
+  for (const closed_t &closed : history) {
+    for (const rollup_entry_t &entry : closed.entries) {
+      out += std::to_string(closed.second) + " " + LEVELS[entry.level].name +
+             " " + std::to_string(entry.lines) + " " + names[entry.source] +
+             "\n";
+    }
+  }
+  return out;
+}
+
+Rollups::~Rollups() {
+  close();
+  if (sidecar != nullptr) {
+    fclose(sidecar);
+  }
+}
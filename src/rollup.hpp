@@ -0,0 +1,123 @@
+#ifndef _ROLLUP_H
+#define _ROLLUP_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "loglevel.hpp"
+#include "logrecord.hpp"
+
+#define ROLLUP_MAGIC "LOGRUP1\n"
+#define ROLLUP_MAGIC_LEN 8
+#define ROLLUP_SUFFIX ".rollup"
+// closed seconds kept for the control surface
+#define ROLLUP_HISTORY 60
+
+/**
+ * a rollup sidecar is ROLLUP_MAGIC followed by frames, each a
+ * rollup_header_t and its body
+ * - SOURCE :- count bytes of a source name, sources are numbered from 0 in
+ *             the order they appear in the file
+ * - SECOND :- count rollup_entry_t, the lines each source sent at each level
+ *             during second, sources a second refers to are defined before it
+ *
+ * every field is fixed width and little endian, so a dashboard can read the
+ * file without any of this code
+ */
+enum rollup_frame_t : uint8_t { SOURCE = 'S', SECOND = 'C' };
+
+struct rollup_header_t {
+  uint8_t kind;
+  uint8_t reserved[3];
+  uint32_t count;
+  // SECOND: seconds since the epoch
+  uint64_t second;
+};
+
+struct rollup_entry_t {
+  uint32_t source;
+  uint32_t lines;
+  uint8_t level;
+  uint8_t reserved[3];
+};
+
+static_assert(sizeof(rollup_header_t) == 16, "rollup header must be packed");
+static_assert(sizeof(rollup_entry_t) == 12, "rollup entry must be packed");
+
+/**
+ * lines per level per source per second, by receive time
+ *
+ * the open second is only ever touched by the queue thread, so counting a
+ * record takes no lock, the source is only looked up when it changes from
+ * the record before. once a record from a later second arrives, or tick
+ * finds the clock has moved on, the open second is closed: appended to
+ * <name>.rollup and kept for report, which takes the one lock. killing the
+ * logger loses the second that is still open
+ */
+class Rollups {
+public:
+  /**
+   * rollups are off unless enabled, the sidecar is only written for a log
+   * file
+   */
+  Rollups(const std::string &name, bool enabled);
+
+  bool enabled() const;
+
+  /**
+   * counts record, queue thread only
+   */
+  void add(const LogRecord &record);
+
+  /**
+   * closes the open second if now, in nanoseconds since the epoch, is past
+   * it, queue thread only
+   */
+  void tick(uint64_t now);
+
+  /**
+   * "rollups <n> seconds" followed by "<second> <level> <lines> <source>"
+   * for each of the last ROLLUP_HISTORY seconds that saw a record, threadsafe
+   */
+  std::string report();
+
+  ~Rollups();
+
+private:
+  struct closed_t {
+    uint64_t second;
+    std::vector<rollup_entry_t> entries;
+  };
+
+  bool on;
+  FILE *sidecar;
+
+  uint64_t open_second;
+  std::unordered_map<std::string, std::array<uint32_t, LOG_LEVELS>> open;
+  // counts of the source of the last record, the map's nodes don't move
+  std::string last_source;
+  std::array<uint32_t, LOG_LEVELS> *counts;
+
+  // source -> id, names[id] -> source, ids are also those of the sidecar
+  std::unordered_map<std::string, uint32_t> ids;
+  std::mutex lock;
+  std::vector<std::string> names;
+  std::deque<closed_t> history;
+
+  /**
+   * reads the sources of an existing sidecar so their ids carry on,
+   * dropping a frame cut short by a crash
+   */
+  void load(const std::string &path);
+
+  void close();
+};
+
+#endif // _ROLLUP_H
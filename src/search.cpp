@@ -0,0 +1,379 @@
+/*
+ * Author: Elijah Mullens
+ * Date: 09/07/2024
+ *
+ * [Description]
+ * Searches the archives written by logserver --archive=on, printing every
+ * record that matches all of the given predicates. Time and level are checked
+ * against each chunk's header first, so chunks outside them are never read,
+ * as are chunks whose trigram filter rules out the text. Text is matched
+ * against the template dictionary before any message is rebuilt.
+ *
+ * The chunks of every archive are searched in parallel, one chunk per thread
+ * at a time, while the results are printed in archive and chunk order, i.e.
+ * time order, with the archives sorted by their first record.
+ *
+ * [Format]
+ * ./logsearch [options...] [archive...]
+ *
+ * [Options]
+ * - --contains=text :- the message contains text
+ * - --level=name[,name...] :- the record has one of these levels, e.g.
+ *   error,fatal
+ * - --trace=id :- the record belongs to this trace, 32 hex digits
+ * - --since=time, --until=time :- received within [since, until], as epoch
+ *   seconds or 2024-07-09T12:00:00 (UTC)
+ * - --line-format=template :- layout of each printed record, see LineFormat
+ *   (default "{time} [{level}] {source}: {message}")
+ * - --max=n :- stop after the first n matches (default 0, all of them)
+ * - --threads=n :- number of search threads (default one per core)
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "archive.hpp"
+#include "logformat.hpp"
+#include "loglevel.hpp"
+
+// chunks searched ahead of the one being printed, per thread
+#define SEARCH_AHEAD 4
+
+struct Query {
+  std::string contains;
+  // bit 1 << level for every wanted level
+  uint32_t levels = ~0u;
+  uint64_t since = 0;
+  uint64_t until = UINT64_MAX;
+  bool traced = false;
+  uint8_t trace_id[TRACE_ID_LEN];
+  std::string line_format = "{time} [{level}] {source}: {message}";
+  size_t max = 0;
+  size_t threads = 0;
+};
+
+/**
+ * a records chunk to search, filled in with its matches by a search thread
+ */
+struct task_t {
+  const ArchiveReader *archive;
+  off_t offset;
+  archive_header_t header;
+
+  bool done = false;
+  std::string out;
+  // end of each matching line in out
+  std::vector<size_t> ends;
+};
+
+/**
+ * the tasks shared by the search threads and the printing thread
+ */
+struct Search {
+  const Query &query;
+  std::vector<task_t> tasks;
+  size_t next = 0;
+  size_t printed = 0;
+  size_t ahead = 0;
+  bool stop = false;
+  std::mutex lock;
+  // signalled when a task is done and when one is printed
+  std::condition_variable changed;
+
+  Search(const Query &query) : query(query) {}
+};
+
+uint64_t get_time(const std::string &value) {
+  struct tm tm = {};
+  const char *end = strptime(value.c_str(), "%Y-%m-%dT%H:%M:%S", &tm);
+  if (end != nullptr && *end == '\0') {
+    return timegm(&tm) * 1000000000ull;
+  }
+
+  char *digits;
+  errno = 0;
+  unsigned long long secs = strtoull(value.c_str(), &digits, 10);
+  if (errno != 0 || digits == value.c_str() || *digits != '\0') {
+    fprintf(stderr, "invalid time %s\n", value.c_str());
+    exit(EXIT_FAILURE);
+  }
+  return secs * 1000000000ull;
+}
+
+size_t get_count(const std::string &key, const std::string &value) {
+  char *end;
+  errno = 0;
+  unsigned long long count = strtoull(value.c_str(), &end, 10);
+  if (errno != 0 || end == value.c_str() || *end != '\0') {
+    fprintf(stderr, "%s must be a number\n", key.c_str());
+    exit(EXIT_FAILURE);
+  }
+  return count;
+}
+
+uint32_t get_levels(const std::string &value) {
+  uint32_t levels = 0;
+  size_t start = 0;
+  while (start <= value.size()) {
+    size_t end = std::min(value.find(',', start), value.size());
+    std::string name = value.substr(start, end - start);
+
+    int level = 0;
+    while (level < LOG_LEVELS && name != LEVELS[level].name) {
+      level++;
+    }
+    if (level == LOG_LEVELS) {
+      fprintf(stderr, "unknown level %s\n", name.c_str());
+      exit(EXIT_FAILURE);
+    }
+    levels |= 1u << level;
+    start = end + 1;
+  }
+  return levels;
+}
+
+void parse_option(Query &query, char *option) {
+  std::string opt(option);
+  size_t eq = opt.find('=');
+  if (eq == std::string::npos) {
+    fprintf(stderr, "invalid option %s\n", option);
+    exit(EXIT_FAILURE);
+  }
+
+  std::string key = opt.substr(2, eq - 2);
+  std::string value = opt.substr(eq + 1);
+
+  if (key == "contains") {
+    query.contains = value;
+  } else if (key == "level") {
+    query.levels = get_levels(value);
+  } else if (key == "trace") {
+    query.traced = true;
+    if (!parse_hex_id(value.data(), value.data() + value.size(),
+                      query.trace_id, TRACE_ID_LEN)) {
+      fprintf(stderr, "trace must be 32 hex digits\n");
+      exit(EXIT_FAILURE);
+    }
+  } else if (key == "since") {
+    query.since = get_time(value);
+  } else if (key == "until") {
+    query.until = get_time(value);
+  } else if (key == "line-format") {
+    query.line_format = value;
+  } else if (key == "max") {
+    query.max = get_count(key, value);
+  } else if (key == "threads") {
+    query.threads = get_count(key, value);
+  } else {
+    fprintf(stderr, "unknown option %s\n", key.c_str());
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * adds a task for every chunk of reader that may hold a match, returns the
+ * time of the archive's first record
+ */
+uint64_t index_archive(ArchiveReader &reader, const Query &query,
+                       std::vector<task_t> &tasks) {
+  uint64_t first = UINT64_MAX;
+  archive_header_t header;
+  while (reader.next(header)) {
+    first = std::min(first, header.min_time);
+    if ((header.levels & query.levels) == 0 || header.max_time < query.since ||
+        header.min_time > query.until ||
+        (!query.contains.empty() && !reader.may_contain(query.contains))) {
+      continue;
+    }
+
+    task_t task;
+    task.archive = &reader;
+    task.offset = reader.offset();
+    task.header = header;
+    tasks.push_back(std::move(task));
+  }
+  return first;
+}
+
+/**
+ * formats the records of the task's chunk that match query into task.out,
+ * stopping at query.max
+ */
+void search_chunk(task_t &task, const Query &query, LineFormat &format) {
+  const ArchiveReader &reader = *task.archive;
+  std::vector<LogRecord> records;
+  if (!reader.records(task.offset, task.header, records)) {
+    return;
+  }
+
+  // per template: whether the literal text alone decides the match
+  std::unordered_map<uint32_t, bool> literal;
+  for (LogRecord &record : records) {
+    if (record.level >= LOG_LEVELS ||
+        (query.levels & (1u << record.level)) == 0 ||
+        record.time < query.since || record.time > query.until ||
+        (query.traced && memcmp(record.trace.trace_id, query.trace_id,
+                                TRACE_ID_LEN) != 0)) {
+      continue;
+    }
+    if (!query.contains.empty()) {
+      auto hit = literal.find(record.template_id);
+      if (hit == literal.end()) {
+        bool match = record.template_id != 0 &&
+                     literal_match(reader.text(record.template_id),
+                                   query.contains);
+        hit = literal.emplace(record.template_id, match).first;
+      }
+      if (!hit->second) {
+        if (record.template_id != 0) {
+          record.message = expand_template(reader.text(record.template_id),
+                                           record.params);
+        }
+        if (record.message.find(query.contains) == std::string::npos) {
+          continue;
+        }
+      }
+    }
+    if (record.template_id != 0 && record.message.empty()) {
+      record.message =
+          expand_template(reader.text(record.template_id), record.params);
+    }
+
+    size_t at = task.out.size();
+    task.out.resize(at + format.measure(record) + 1);
+    char *end = format.format(record, &task.out[at]);
+    *end++ = '\n';
+    task.out.resize(end - task.out.data());
+    task.ends.push_back(task.out.size());
+    if (query.max != 0 && task.ends.size() == query.max) {
+      break;
+    }
+  }
+}
+
+/**
+ * takes tasks in order until they run out or the search stops, staying at
+ * most search.ahead tasks ahead of the printing thread
+ */
+void search_thread(Search &search) {
+  LineFormat format(search.query.line_format);
+  for (;;) {
+    task_t *task;
+    {
+      std::unique_lock<std::mutex> guard(search.lock);
+      search.changed.wait(guard, [&search] {
+        return search.stop || search.next == search.tasks.size() ||
+               search.next < search.printed + search.ahead;
+      });
+      if (search.stop || search.next == search.tasks.size()) {
+        return;
+      }
+      task = &search.tasks[search.next++];
+    }
+
+    search_chunk(*task, search.query, format);
+    {
+      std::lock_guard<std::mutex> guard(search.lock);
+      task->done = true;
+    }
+    search.changed.notify_all();
+  }
+}
+
+int main(int argc, char **argv) {
+  Query query;
+  std::vector<std::string> paths;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--", 2) == 0) {
+      parse_option(query, argv[i]);
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty()) {
+    fprintf(stderr, "usage: %s [options...] archive...\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  // index every archive, then order their tasks by each archive's first record
+  int status = EXIT_SUCCESS;
+  std::vector<std::unique_ptr<ArchiveReader>> archives;
+  std::vector<std::pair<uint64_t, std::vector<task_t>>> indexed;
+  for (const std::string &path : paths) {
+    archives.push_back(std::make_unique<ArchiveReader>());
+    if (!archives.back()->open(path)) {
+      fprintf(stderr, "couldn't read archive %s\n", path.c_str());
+      status = EXIT_FAILURE;
+      continue;
+    }
+    indexed.emplace_back();
+    indexed.back().first =
+        index_archive(*archives.back(), query, indexed.back().second);
+  }
+  std::stable_sort(
+      indexed.begin(), indexed.end(),
+      [](const auto &a, const auto &b) { return a.first < b.first; });
+
+  Search search(query);
+  for (auto &archive : indexed) {
+    for (task_t &task : archive.second) {
+      search.tasks.push_back(std::move(task));
+    }
+  }
+
+  size_t threads = query.threads;
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  threads = std::min(threads, search.tasks.size());
+  search.ahead = SEARCH_AHEAD * std::max(threads, (size_t)1);
+  std::vector<std::thread> pool;
+  for (size_t i = 0; i < threads; i++) {
+    pool.emplace_back(search_thread, std::ref(search));
+  }
+
+  size_t matches = 0;
+  for (task_t &task : search.tasks) {
+    {
+      std::unique_lock<std::mutex> guard(search.lock);
+      search.changed.wait(guard, [&task] { return task.done; });
+    }
+
+    size_t count = task.ends.size();
+    if (query.max != 0) {
+      count = std::min(count, query.max - matches);
+    }
+    if (count > 0) {
+      fwrite(task.out.data(), 1, task.ends[count - 1], stdout);
+    }
+    matches += count;
+    std::string().swap(task.out);
+
+    bool full = query.max != 0 && matches == query.max;
+    {
+      std::lock_guard<std::mutex> guard(search.lock);
+      search.printed++;
+      search.stop = full;
+    }
+    search.changed.notify_all();
+    if (full) {
+      break;
+    }
+  }
+
+  for (std::thread &thread : pool) {
+    thread.join();
+  }
+  return status;
+}
@@ -5,33 +5,70 @@
 
 #include "logserver.hpp"
 
+volatile sig_atomic_t report_requested = 0;
+
+uint64_t realtime_nanoseconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+time_t monotonic_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
 /**
- * ensures that file is not STDOUT before closing, otherwise leaving untouched
- *
- * parameters:
- * - file (FILE *): file to be checked then closed
+ * sets an integer socket option, warning rather than terminating when the
+ * kernel refuses it (e.g. SO_BUSY_POLL without CAP_NET_ADMIN)
  */
-void close_file(fd_t file) {
-  if (STDOUT != file) {
-    close(file);
+static void tune_socket(fd_t sock, int level, int opt, int value,
+                        const char *name) {
+  if (setsockopt(sock, level, opt, &value, sizeof(value)) < 0) {
+    fprintf(stderr, "couldn't set %s: %s\n", name, strerror(errno));
   }
 }
 
-Logger::Logger(std::string name, port_t port) {
-  if (name == "stdout") {
-    file = STDOUT;
-  } else {
-    if ((file = open(name.c_str(), O_WRONLY | O_APPEND | O_CREAT,
-                     S_IRUSR | S_IWUSR)) < 0) {
-      perror("couldn't create file in append mode");
-      exit(EXIT_FAILURE);
+Logger::Logger(LoggerConfig config)
+    : writer(config),
+      line_format(config.line_format, config.multiline, config.continuation),
+      redactor(config.redact), batch_len(0), batch_size(config.batch_size),
+      batch_levels(0), segment_levels(0),
+      busy_poll(config.busy_poll), read_budget(config.read_budget),
+      record_budget(config.record_budget), idle_timeout(config.idle_timeout),
+      next_id(0), idle_wheel(IDLE_WHEEL_SLOTS, monotonic_seconds()),
+      unknown_levels(0), talkers(config.top_k),
+      rollups(config.name, config.rollups),
+      alerts(config.alerts, config.alert_exec, config.alert_fifo),
+      tail(config.tail_window, config.tail_budget),
+      miner(config.templates),
+      archive(config.archive ? config.name : "", miner, config.compress,
+              config.recompress),
+      retention(config.name, config.disk_budget, config.rotate_size),
+      control(-1), syslog_udp(-1), syslog_tcp(-1), syslog_unix(-1),
+      http(-1) {
+  if (read_budget == 0 || record_budget == 0) {
+    fprintf(stderr, "read budgets must be positive\n");
+    exit(EXIT_FAILURE);
+  }
+
+  writer.onRotate([this](const std::string &rotated) {
+    archive.rotate(rotated);
+    if (retention.enabled()) {
+      retention.sealed(rotated, segment_levels);
     }
+    segment_levels = 0;
+  });
+
+  if ((batch = (char *)huge_alloc(batch_size, config.hugepages)) == nullptr) {
+    fprintf(stderr, "couldn't allocate batch buffer\n");
+    exit(EXIT_FAILURE);
   }
 
   sock = socket(AF_INET, SOCK_STREAM, 0);
-  if (errno != 0) {
+  if (sock < 0) {
     perror("couldn't create socket");
-    close_file(file);
     exit(EXIT_FAILURE);
   }
 
@@ -40,108 +77,1057 @@ Logger::Logger(std::string name, port_t port) {
                  sizeof(opt)) < 0) {
     perror("couldn't set sock opts");
     close(sock);
-    close_file(file);
     exit(EXIT_FAILURE);
   }
 
+  // accepted connections inherit the buffer sizes, which must be set before
+  // listen for the receive window to scale
+  if (config.rcvbuf > 0) {
+    tune_socket(sock, SOL_SOCKET, SO_RCVBUF, config.rcvbuf, "SO_RCVBUF");
+  }
+  if (config.sndbuf > 0) {
+    tune_socket(sock, SOL_SOCKET, SO_SNDBUF, config.sndbuf, "SO_SNDBUF");
+  }
+
   addr = {0};
   addr.sin_family = AF_INET;
-  addr.sin_port = htons(port);
+  addr.sin_port = htons(config.port);
   addr.sin_addr.s_addr = INADDR_ANY;
 
   if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
     perror("failed to bind socket");
     close(sock);
-    close_file(file);
     exit(EXIT_FAILURE);
   }
 
   if (listen(sock, SOMAXCONN) < 0) {
     perror("failed to listen");
     close(sock);
-    close_file(file);
     exit(EXIT_FAILURE);
   }
 
+  if (fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK) < 0) {
+    perror("couldn't make socket non-blocking");
+    close(sock);
+    exit(EXIT_FAILURE);
+  }
+
+  if ((epoll = epoll_create1(0)) < 0) {
+    perror("couldn't create epoll instance");
+    close(sock);
+    exit(EXIT_FAILURE);
+  }
+
+  struct epoll_event event = {0};
+  event.events = EPOLLIN;
+  event.data.fd = sock;
+  if (epoll_ctl(epoll, EPOLL_CTL_ADD, sock, &event) < 0) {
+    perror("couldn't watch socket");
+    close(sock);
+    exit(EXIT_FAILURE);
+  }
+
+  if (!config.control.empty()) {
+    openControl(config.control);
+  }
+  openListeners(config);
+
   std::string header("\
 -------------------------------------------------------------------------------\n\
                                   New Log\n\
 -------------------------------------------------------------------------------\n\
 ");
-  pushQueue(std::make_pair(HEADER, header));
+  pushQueue(
+      {HEADER, realtime_nanoseconds(), (uint32_t)getpid(), "", "", header});
   std::thread qp_thread(&Logger::processQueue, this);
 
   this->start();
 }
 
 void Logger::start() {
+  struct epoll_event events[MAX_EVENTS];
+
+  while (true) {
+    // connections left over budget from the last pass are serviced without
+    // waiting, otherwise wake once a second to reap idle connections
+    int n = epoll_wait(epoll, events, MAX_EVENTS, ready.empty() ? 1000 : 0);
+    if (report_requested) {
+      report_requested = 0;
+      std::string report = connectionReport();
+      fwrite(report.data(), 1, report.size(), stderr);
+    }
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("couldn't wait for connections");
+      close(sock);
+      exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < n; i++) {
+      if (events[i].data.fd == sock || events[i].data.fd == syslog_tcp ||
+          events[i].data.fd == http) {
+        acceptConnections(events[i].data.fd);
+      } else if (events[i].data.fd == syslog_udp ||
+                 events[i].data.fd == syslog_unix) {
+        serviceDatagrams(events[i].data.fd);
+      } else if (events[i].data.fd == control) {
+        acceptControl();
+      } else if (controls.count(events[i].data.fd)) {
+        serviceControl(events[i].data.fd);
+      } else {
+        markReady(events[i].data.fd);
+      }
+    }
+
+    serviceReady();
+    reapIdle();
+  }
+}
+
+void Logger::acceptConnections(fd_t listener) {
   while (true) {
     socklen_t len = sizeof(addr);
-    fd_t msg_d = accept(sock, (struct sockaddr *)&addr, &len);
-    if (errno != 0) {
+    fd_t msg_d =
+        accept4(listener, (struct sockaddr *)&addr, &len, SOCK_NONBLOCK);
+    if (msg_d < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED) {
+        return;
+      }
       perror("couldn't accept message");
-      close(sock);
-      close_file(file);
+      close(listener);
       exit(EXIT_FAILURE);
     }
+    if (busy_poll > 0) {
+      tune_socket(msg_d, SOL_SOCKET, SO_BUSY_POLL, busy_poll, "SO_BUSY_POLL");
+    }
 
-    bool first_read = true;
-    std::string msg = "";
-    uint8_t level;
-    char buf[LINE_MAX] = {0};
-    ssize_t bytes;
-    while ((bytes = read(msg_d, buf, LINE_MAX - 1)) > 0) {
-      if (bytes < 1) {
-        break;
+    struct epoll_event event = {0};
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    event.data.fd = msg_d;
+    if (epoll_ctl(epoll, EPOLL_CTL_ADD, msg_d, &event) < 0) {
+      perror("couldn't watch connection");
+      close(msg_d);
+      continue;
+    }
+
+    protocol_t protocol = listener == syslog_tcp ? protocol_t::SYSLOG
+                          : listener == http   ? protocol_t::HTTP
+                                               : protocol_t::NATIVE;
+    Connection conn = {msg_d, "", false, next_id++, monotonic_seconds(), addr,
+                       inet_ntoa(addr.sin_addr), protocol};
+    connections[msg_d] = conn;
+    if (idle_timeout > 0) {
+      idle_wheel.schedule(std::make_pair(msg_d, conn.id),
+                          conn.last_active + idle_timeout);
+    }
+    // edge triggered, data that arrived before EPOLL_CTL_ADD raises no event
+    markReady(msg_d);
+  }
+}
+
+void Logger::markReady(fd_t fd) {
+  auto conn = connections.find(fd);
+  if (conn == connections.end() || conn->second.queued) {
+    return;
+  }
+
+  conn->second.queued = true;
+  ready.push_back(fd);
+}
+
+/**
+ * one round robin pass over the ready list, every connection gets at most one
+ * budget's worth of reading before the next one is serviced
+ */
+void Logger::serviceReady() {
+  for (size_t n = ready.size(); n > 0; n--) {
+    fd_t fd = ready.front();
+    ready.pop_front();
+
+    auto conn = connections.find(fd);
+    if (conn == connections.end()) {
+      continue;
+    }
+
+    conn->second.queued = false;
+    if (serviceConnection(conn->second)) {
+      markReady(fd);
+    }
+  }
+}
+
+bool Logger::serviceConnection(Connection &conn) {
+  char buf[LINE_MAX];
+  size_t bytes_left = read_budget;
+  size_t records = 0;
+
+  conn.last_active = monotonic_seconds();
+  while (bytes_left > 0 && records < record_budget) {
+    ssize_t bytes = read(conn.fd, buf, std::min(bytes_left, sizeof(buf)));
+    if (bytes < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        // going idle, so give back the record buffer until the next partial
+        // record needs it
+        if (conn.pending.empty()) {
+          std::string().swap(conn.pending);
+        }
+        return false;
+      }
+      closeConnection(conn.fd);
+      return false;
+    }
+    if (bytes == 0) {
+      closeConnection(conn.fd);
+      return false;
+    }
+    bytes_left -= bytes;
+
+    if (conn.protocol == protocol_t::SYSLOG) {
+      if (!splitSyslog(conn, buf, bytes, records)) {
+        fprintf(stderr, "invalid syslog frame\n");
+        closeConnection(conn.fd);
+        return false;
+      }
+      continue;
+    }
+    if (conn.protocol == protocol_t::HTTP) {
+      if (!splitHttp(conn, buf, bytes, records)) {
+        closeConnection(conn.fd);
+        return false;
+      }
+      continue;
+    }
+
+    // records are NUL terminated, anything after the last NUL is the start
+    // of a record still in flight, only those are copied into pending
+    const char *start = buf;
+    const char *end = buf + bytes;
+    const char *nul;
+    while ((nul = (const char *)memchr(start, '\0', end - start)) != NULL) {
+      bool valid;
+      if (conn.pending.empty()) {
+        valid = parseRecord(conn, start, nul - start);
+      } else {
+        conn.pending.append(start, nul - start);
+        valid =
+            parseRecord(conn, conn.pending.data(), conn.pending.size());
+        conn.pending.clear();
+      }
+      if (!valid) {
+        closeConnection(conn.fd);
+        return false;
+      }
+      records++;
+      start = nul + 1;
+    }
+    conn.pending.append(start, end - start);
+    if (conn.pending.size() > RECORD_MAX) {
+      fprintf(stderr, "record too long\n");
+      // dropped rather than accepted as a record cut short
+      conn.pending.clear();
+      closeConnection(conn.fd);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool Logger::parseRecord(Connection &conn, const char *record, size_t len) {
+  const char *colon = (const char *)memchr(record, ':', len);
+  if (colon == NULL) {
+    fprintf(stderr, "invalid message\n");
+    return false;
+  }
+
+  // levels past LOG_LEVELS are still queued so commitLog can count them
+  long l = 0;
+  const char *digit = record;
+  for (; digit < colon && *digit >= '0' && *digit <= '9' && l <= UINT8_MAX;
+       digit++) {
+    l = l * 10 + (*digit - '0');
+  }
+  if (digit == record || (digit != colon && *digit != ',') || l > UINT8_MAX) {
+    fprintf(stderr, "invalid log level\n");
+    return false;
+  }
+
+  LogRecord log = {(uint8_t)l, realtime_nanoseconds(), 0, "", "", ""};
+
+  // ,key=value pairs between the level and the colon
+  const char *field = digit;
+  while (field < colon) {
+    const char *key = field + 1;
+    const char *end = (const char *)memchr(key, ',', colon - key);
+    if (end == NULL) {
+      end = colon;
+    }
+    const char *eq = (const char *)memchr(key, '=', end - key);
+    if (eq == NULL) {
+      fprintf(stderr, "invalid log field\n");
+      return false;
+    }
+
+    if (eq - key == 3 && memcmp(key, "pid", 3) == 0) {
+      log.pid = strtoul(eq + 1, NULL, 10);
+    } else if (eq - key == 3 && memcmp(key, "src", 3) == 0) {
+      log.source.assign(eq + 1, end);
+    } else if (eq - key == 5 && memcmp(key, "trace", 5) == 0) {
+      if (!parse_hex_id(eq + 1, end, log.trace.trace_id, TRACE_ID_LEN)) {
+        fprintf(stderr, "invalid trace id\n");
+        return false;
+      }
+    } else if (eq - key == 4 && memcmp(key, "span", 4) == 0) {
+      if (!parse_hex_id(eq + 1, end, log.trace.span_id, SPAN_ID_LEN)) {
+        fprintf(stderr, "invalid span id\n");
+        return false;
+      }
+    } else {
+      if (!log.fields.empty()) {
+        log.fields += ' ';
+      }
+      log.fields.append(key, end);
+    }
+    field = end;
+  }
+
+  if (log.source.empty()) {
+    log.source = conn.peer_name;
+  }
+  log.message.assign(colon + 1, record + len);
+
+  this->pushQueue(std::move(log));
+  return true;
+}
+
+bool Logger::splitSyslog(Connection &conn, const char *data, size_t len,
+                         size_t &records) {
+  // as with NUL terminated records, only a partial frame is copied
+  bool buffered = !conn.pending.empty();
+  if (buffered) {
+    conn.pending.append(data, len);
+    data = conn.pending.data();
+    len = conn.pending.size();
+  }
+
+  uint64_t now = realtime_nanoseconds();
+  size_t used = 0;
+  ssize_t n;
+  std::string_view frame;
+  while ((n = syslog_frame(data + used, len - used, frame)) > 0) {
+    if (!frame.empty() && frame != "\r") {
+      received.push_back(syslogRecord(frame, conn.peer_name.c_str(), now));
+    }
+    records++;
+    used += n;
+  }
+  pushQueue(received);
+  if (n < 0) {
+    conn.pending.clear();
+    return false;
+  }
+
+  if (buffered) {
+    conn.pending.erase(0, used);
+  } else {
+    conn.pending.assign(data + used, len - used);
+  }
+  return true;
+}
+
+/**
+ * the source is the APP-NAME (or TAG), else the hostname, else peer. the
+ * hostname, MSGID and structured data params become fields
+ */
+LogRecord Logger::syslogRecord(std::string_view data, const char *peer,
+                               uint64_t time) {
+  syslog_msg_t msg;
+  parse_syslog(data.data(), data.size(), msg);
+
+  uint32_t pid = 0;
+  for (char c : msg.procid) {
+    if (c < '0' || c > '9') {
+      pid = 0;
+      break;
+    }
+    pid = pid * 10 + (c - '0');
+  }
+  LogRecord log = {msg.level, time, pid, "", "", ""};
+
+  if (!msg.app.empty()) {
+    log.source.assign(msg.app);
+  } else if (!msg.host.empty()) {
+    log.source.assign(msg.host);
+  } else {
+    log.source = peer;
+  }
+
+  if (!msg.host.empty()) {
+    log.fields.append("host=").append(msg.host);
+  }
+  if (!msg.msgid.empty()) {
+    log.fields.append(log.fields.empty() ? "" : " ").append("msgid=");
+    log.fields.append(msg.msgid);
+  }
+  std::string_view name, value;
+  while (next_sd_param(msg.structured, name, value)) {
+    log.fields.append(log.fields.empty() ? "" : " ").append(name);
+    log.fields += '=';
+    for (size_t i = 0; i < value.size(); i++) {
+      if (value[i] == '\\' && i + 1 < value.size()) {
+        i++;
       }
+      log.fields += value[i];
+    }
+  }
 
-      size_t buf_start = 0;
-      if (first_read) {
-        for (; buf_start < LINE_MAX && buf[buf_start] != ':'; buf_start++)
-          ;
-        if (buf_start == LINE_MAX) {
-          printf("invalid message");
-          exit(EXIT_FAILURE);
+  log.message.assign(msg.message);
+  return log;
+}
+
+void Logger::serviceDatagrams(fd_t fd) {
+  struct mmsghdr msgs[SYSLOG_BATCH];
+  struct iovec iovs[SYSLOG_BATCH];
+  struct sockaddr_in peers[SYSLOG_BATCH];
+  for (size_t i = 0; i < SYSLOG_BATCH; i++) {
+    iovs[i] = {&datagrams[i * SYSLOG_DATAGRAM_MAX], SYSLOG_DATAGRAM_MAX};
+    msgs[i] = {};
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  // the socket is level triggered, datagrams left over the budget wake the
+  // loop again once the connections have had their turn
+  for (size_t records = 0; records < record_budget;) {
+    for (size_t i = 0; i < SYSLOG_BATCH && fd == syslog_udp; i++) {
+      msgs[i].msg_hdr.msg_name = &peers[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof(peers[i]);
+    }
+    int n = recvmmsg(fd, msgs, SYSLOG_BATCH, MSG_DONTWAIT, NULL);
+    if (n <= 0) {
+      return;
+    }
+
+    uint64_t now = realtime_nanoseconds();
+    for (int i = 0; i < n; i++) {
+      if (msgs[i].msg_len == 0) {
+        continue;
+      }
+      const char *peer =
+          fd == syslog_udp ? inet_ntoa(peers[i].sin_addr) : "localhost";
+      received.push_back(syslogRecord(
+          std::string_view((char *)iovs[i].iov_base, msgs[i].msg_len), peer,
+          now));
+    }
+    pushQueue(received);
+    records += n;
+  }
+}
+
+bool Logger::splitHttp(Connection &conn, const char *data, size_t len,
+                       size_t &records) {
+  // as with NUL terminated records, only a partial line is copied
+  bool buffered = !conn.pending.empty();
+  if (buffered) {
+    conn.pending.append(data, len);
+    data = conn.pending.data();
+    len = conn.pending.size();
+  }
+
+  size_t used = 0;
+  while (used < len) {
+    const char *start = data + used;
+    if (conn.body_left == 0) {
+      const char *head_end =
+          (const char *)memmem(start, len - used, "\r\n\r\n", 4);
+      if (head_end == NULL) {
+        if (len - used > HTTP_HEADER_MAX) {
+          conn.keep_alive = false;
+          respondHttp(conn, 431, "request headers too long\n");
+          return false;
         }
+        break;
+      }
+      used = head_end + 4 - data;
+
+      int status = parseHttpRequest(conn, start, head_end + 2 - start);
+      if (status != 0) {
+        conn.keep_alive = false;
+        respondHttp(conn, status, "request refused\n");
+        return false;
+      }
+      if (conn.body_left == 0 && !finishHttp(conn)) {
+        return false;
+      }
+      continue;
+    }
 
-        buf[buf_start] = '\0';
-        long l = strtol(buf, NULL, 10);
-        assert(errno == 0);
-        assert(l >= 0 && l <= 3);
+    // lines are parsed where they lie, the body's last needn't end in \n
+    const char *end = start + std::min(len - used, conn.body_left);
+    bool last = (size_t)(end - start) == conn.body_left;
+    const char *line = start;
+    while (line < end) {
+      const char *nl = (const char *)memchr(line, '\n', end - line);
+      const char *line_end = nl != NULL ? nl : end;
+      // refused before it is buffered any further
+      if (line_end - line > HTTP_LINE_MAX) {
+        conn.keep_alive = false;
+        respondHttp(conn, 413, "record line too long\n");
+        return false;
+      }
+      if (nl == NULL && !last) {
+        break;
+      }
+      size_t line_len = line_end - line;
+      if (line_len > 0 && line[line_len - 1] == '\r') {
+        line_len--;
+      }
+      if (line_len > 0) {
+        conn.invalid += !parseRecord(conn, line, line_len);
+        records++;
+      }
+      line = nl != NULL ? nl + 1 : end;
+    }
+    conn.body_left -= line - start;
+    used = line - data;
+
+    if (conn.body_left > 0) {
+      break;
+    }
+    if (!finishHttp(conn)) {
+      return false;
+    }
+  }
+
+  if (buffered) {
+    conn.pending.erase(0, used);
+  } else {
+    conn.pending.assign(data + used, len - used);
+  }
+  return true;
+}
+
+/**
+ * whether the header name (or value) s is lower, ignoring case
+ */
+static bool header_is(std::string_view s, const char *lower) {
+  return s.size() == strlen(lower) &&
+         strncasecmp(s.data(), lower, s.size()) == 0;
+}
+
+int Logger::parseHttpRequest(Connection &conn, const char *head, size_t len) {
+  const char *end = head + len;
+  const char *eol = (const char *)memchr(head, '\n', len);
+  std::string_view request(head, eol - head);
+  if (!request.empty() && request.back() == '\r') {
+    request.remove_suffix(1);
+  }
+  size_t space = request.find(' ');
+  if (space == std::string_view::npos || request.size() < 9) {
+    return 400;
+  }
+  std::string_view method = request.substr(0, space);
+  std::string_view version = request.substr(request.size() - 9);
+  if (version == " HTTP/1.1") {
+    conn.keep_alive = true;
+  } else if (version == " HTTP/1.0") {
+    conn.keep_alive = false;
+  } else {
+    return 505;
+  }
+
+  bool has_length = false;
+  bool expect_continue = false;
+  size_t length = 0;
+  for (const char *line = eol + 1; line < end; line = eol + 1) {
+    eol = (const char *)memchr(line, '\n', end - line);
+    std::string_view header(line, eol - line);
+    if (!header.empty() && header.back() == '\r') {
+      header.remove_suffix(1);
+    }
+    size_t colon = header.find(':');
+    if (colon == std::string_view::npos) {
+      return 400;
+    }
+    std::string_view name = header.substr(0, colon);
+    std::string_view value = header.substr(colon + 1);
+    while (!value.empty() && (value[0] == ' ' || value[0] == '\t')) {
+      value.remove_prefix(1);
+    }
+    while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) {
+      value.remove_suffix(1);
+    }
 
-        level = l;
-        buf_start++;
-        first_read = false;
+    if (header_is(name, "content-length")) {
+      if (value.empty() || value.size() > 18 ||
+          value.find_first_not_of("0123456789") != std::string_view::npos) {
+        return 400;
+      }
+      length = 0;
+      for (char c : value) {
+        length = length * 10 + (c - '0');
       }
+      has_length = true;
+    } else if (header_is(name, "transfer-encoding")) {
+      return 501;
+    } else if (header_is(name, "connection")) {
+      if (header_is(value, "close")) {
+        conn.keep_alive = false;
+      } else if (header_is(value, "keep-alive")) {
+        conn.keep_alive = true;
+      }
+    } else if (header_is(name, "expect")) {
+      expect_continue = header_is(value, "100-continue");
+    }
+  }
+
+  if (method != "POST") {
+    return 405;
+  }
+  if (!has_length) {
+    return 411;
+  }
+  conn.body_left = length;
+  conn.invalid = 0;
+  // clients like curl hold back large bodies until they're told to go on
+  if (expect_continue && length > 0) {
+    respondHttp(conn, 100, "");
+  }
+  return 0;
+}
+
+bool Logger::finishHttp(Connection &conn) {
+  bool sent;
+  if (conn.invalid > 0) {
+    std::string body = std::to_string(conn.invalid) + " invalid records\n";
+    sent = respondHttp(conn, 400, body.c_str());
+  } else {
+    sent = respondHttp(conn, 204, "");
+  }
+  conn.invalid = 0;
+  return sent && conn.keep_alive;
+}
+
+bool Logger::respondHttp(Connection &conn, int status, const char *body) {
+  const char *reason;
+  switch (status) {
+  case 100:
+    reason = "Continue";
+    break;
+  case 204:
+    reason = "No Content";
+    break;
+  case 400:
+    reason = "Bad Request";
+    break;
+  case 405:
+    reason = "Method Not Allowed";
+    break;
+  case 411:
+    reason = "Length Required";
+    break;
+  case 413:
+    reason = "Payload Too Large";
+    break;
+  case 431:
+    reason = "Request Header Fields Too Large";
+    break;
+  case 501:
+    reason = "Not Implemented";
+    break;
+  default:
+    reason = "HTTP Version Not Supported";
+    break;
+  }
+
+  // 1xx and 204 responses carry no body, nor a length for one
+  char response[256];
+  const char *connection = conn.keep_alive ? "" : "Connection: close\r\n";
+  int len;
+  if (status == 100) {
+    len = snprintf(response, sizeof(response), "HTTP/1.1 100 %s\r\n\r\n",
+                   reason);
+  } else if (status == 204) {
+    len = snprintf(response, sizeof(response), "HTTP/1.1 204 %s\r\n%s\r\n",
+                   reason, connection);
+  } else {
+    len = snprintf(response, sizeof(response),
+                   "HTTP/1.1 %d %s\r\nContent-Type: text/plain\r\n"
+                   "Content-Length: %zu\r\n%s\r\n%s",
+                   status, reason, strlen(body), connection, body);
+  }
+  return send(conn.fd, response, len, MSG_NOSIGNAL) == len;
+}
+
+/**
+ * closes every connection the wheel has come around to that has seen no
+ * reads for idle_timeout seconds, the rest are rescheduled from their last
+ * activity
+ */
+void Logger::reapIdle() {
+  if (idle_timeout == 0) {
+    return;
+  }
+
+  time_t now = monotonic_seconds();
+  std::vector<TimerWheel::entry_t> due;
+  idle_wheel.advance(now, due);
+
+  for (TimerWheel::entry_t &entry : due) {
+    auto conn = connections.find(entry.first);
+    if (conn == connections.end() || conn->second.id != entry.second) {
+      continue;
+    }
+
+    time_t deadline = conn->second.last_active + idle_timeout;
+    if (deadline <= now) {
+      closeConnection(entry.first);
+    } else {
+      idle_wheel.schedule(entry, deadline);
+    }
+  }
+}
+
+/**
+ * bytes held on behalf of conn: the Connection itself, its hash map node and
+ * any heap storage behind pending (short strings live inline)
+ */
+size_t Logger::connectionMemory(const Connection &conn) {
+  size_t bytes = sizeof(Connection) + sizeof(fd_t) + 2 * sizeof(void *);
+  const char *data = conn.pending.data();
+  const char *inline_start = (const char *)&conn.pending;
+  if (data < inline_start || data >= inline_start + sizeof(std::string)) {
+    bytes += conn.pending.capacity() + 1;
+  }
+  return bytes;
+}
+
+std::string Logger::connectionReport() {
+  time_t now = monotonic_seconds();
+  size_t total = 0;
+  std::string lines;
+
+  for (auto &it : connections) {
+    Connection &conn = it.second;
+    size_t bytes = connectionMemory(conn);
+    total += bytes;
+
+    char line[128];
+    snprintf(line, sizeof(line), "%zd %s:%u idle=%lds pending=%zu mem=%zu\n",
+             conn.fd, inet_ntoa(conn.peer.sin_addr), ntohs(conn.peer.sin_port),
+             (long)(now - conn.last_active), conn.pending.size(), bytes);
+    lines += line;
+  }
+
+  char summary[128];
+  snprintf(summary, sizeof(summary),
+           "connections=%zu mem=%zu avg=%zu unknown_levels=%lu\n",
+           connections.size(), total,
+           connections.empty() ? 0 : total / connections.size(),
+           (unsigned long)unknown_levels.load());
+  return summary + lines;
+}
+
+/**
+ * a record cut short by the peer closing is still logged, as the original
+ * one-record-per-connection protocol didn't require the trailing NUL
+ */
+void Logger::closeConnection(fd_t fd) {
+  auto conn = connections.find(fd);
+  if (conn == connections.end()) {
+    return;
+  }
+
+  // a syslog message is kept only if it wasn't octet counted, a count cut
+  // short can't be told from garbage. an unfinished HTTP request is dropped
+  const std::string &pending = conn->second.pending;
+  protocol_t protocol = conn->second.protocol;
+  if (protocol == protocol_t::SYSLOG && !pending.empty() &&
+      (pending[0] < '0' || pending[0] > '9')) {
+    pushQueue(syslogRecord(pending, conn->second.peer_name.c_str(),
+                           realtime_nanoseconds()));
+  } else if (protocol == protocol_t::NATIVE && !pending.empty()) {
+    parseRecord(conn->second, pending.data(), pending.size());
+  }
+
+  epoll_ctl(epoll, EPOLL_CTL_DEL, fd, NULL);
+  close(fd);
+  connections.erase(conn);
+}
+
+void Logger::openControl(const std::string &path) {
+  struct sockaddr_un local = {0};
+  if (path.size() >= sizeof(local.sun_path)) {
+    fprintf(stderr, "control socket path too long\n");
+    exit(EXIT_FAILURE);
+  }
+  local.sun_family = AF_UNIX;
+  strcpy(local.sun_path, path.c_str());
+
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(path.c_str());
+  }
+
+  if ((control = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
+    perror("couldn't create control socket");
+    exit(EXIT_FAILURE);
+  }
+  if (bind(control, (struct sockaddr *)&local, sizeof(local)) < 0 ||
+      listen(control, SOMAXCONN) < 0) {
+    perror("couldn't listen on control socket");
+    exit(EXIT_FAILURE);
+  }
+
+  struct epoll_event event = {0};
+  event.events = EPOLLIN;
+  event.data.fd = control;
+  if (epoll_ctl(epoll, EPOLL_CTL_ADD, control, &event) < 0) {
+    perror("couldn't watch control socket");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * a non-blocking socket of type bound to port on every interface, listening
+ * if it is a stream
+ */
+static fd_t bind_port(int type, port_t port) {
+  fd_t fd = socket(AF_INET, type | SOCK_NONBLOCK, 0);
+  if (fd < 0) {
+    perror("couldn't create socket");
+    exit(EXIT_FAILURE);
+  }
+
+  int opt = 1;
+  struct sockaddr_in local = {0};
+  local.sin_family = AF_INET;
+  local.sin_port = htons(port);
+  local.sin_addr.s_addr = INADDR_ANY;
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+      bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0 ||
+      (type == SOCK_STREAM && listen(fd, SOMAXCONN) < 0)) {
+    fprintf(stderr, "couldn't listen on port %u: %s\n", port, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  return fd;
+}
+
+void Logger::openListeners(const LoggerConfig &config) {
+  if (config.syslog_udp > 0) {
+    syslog_udp = bind_port(SOCK_DGRAM, config.syslog_udp);
+    // bursts queue up in the receive buffer, not a connection's
+    if (config.rcvbuf > 0) {
+      tune_socket(syslog_udp, SOL_SOCKET, SO_RCVBUF, config.rcvbuf,
+                  "SO_RCVBUF");
+    }
+  }
+
+  if (config.syslog_tcp > 0) {
+    syslog_tcp = bind_port(SOCK_STREAM, config.syslog_tcp);
+    if (config.rcvbuf > 0) {
+      tune_socket(syslog_tcp, SOL_SOCKET, SO_RCVBUF, config.rcvbuf,
+                  "SO_RCVBUF");
+    }
+  }
+
+  if (!config.syslog_unix.empty()) {
+    const std::string &path = config.syslog_unix;
+    struct sockaddr_un local = {0};
+    if (path.size() >= sizeof(local.sun_path)) {
+      fprintf(stderr, "syslog socket path too long\n");
+      exit(EXIT_FAILURE);
+    }
+    local.sun_family = AF_UNIX;
+    strcpy(local.sun_path, path.c_str());
+
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+      unlink(path.c_str());
+    }
+
+    // any local process may log, as with /dev/log
+    if ((syslog_unix = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0)) < 0 ||
+        bind(syslog_unix, (struct sockaddr *)&local, sizeof(local)) < 0 ||
+        chmod(path.c_str(), 0666) < 0) {
+      perror("couldn't listen on syslog socket");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (config.http > 0) {
+    http = bind_port(SOCK_STREAM, config.http);
+    if (config.rcvbuf > 0) {
+      tune_socket(http, SOL_SOCKET, SO_RCVBUF, config.rcvbuf, "SO_RCVBUF");
+    }
+  }
+
+  for (fd_t fd : {syslog_udp, syslog_tcp, syslog_unix, http}) {
+    struct epoll_event event = {0};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (fd >= 0 && epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) < 0) {
+      perror("couldn't watch listener");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (syslog_udp >= 0 || syslog_unix >= 0) {
+    datagrams.resize(SYSLOG_BATCH * SYSLOG_DATAGRAM_MAX);
+  }
+}
+
+void Logger::acceptControl() {
+  fd_t fd;
+  while ((fd = accept4(control, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+    struct epoll_event event = {0};
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) < 0) {
+      perror("couldn't watch control connection");
+      close(fd);
+      continue;
+    }
+    controls[fd] = "";
+  }
+}
+
+void Logger::serviceControl(fd_t fd) {
+  std::string &request = controls[fd];
+  char buf[256];
+  ssize_t bytes;
+  while ((bytes = read(fd, buf, sizeof(buf))) > 0 &&
+         request.size() <= CONTROL_MAX) {
+    request.append(buf, bytes);
+  }
+
+  size_t eol = request.find('\n');
+  bool waiting = bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+  if (eol == std::string::npos && waiting && request.size() <= CONTROL_MAX) {
+    return;
+  }
+
+  std::string command = request.substr(0, eol);
+  if (!command.empty() && command.back() == '\r') {
+    command.pop_back();
+  }
+  std::string reply = controlCommand(command);
 
-      msg += std::string(&(buf[buf_start]));
-      memset(buf, 0, LINE_MAX);
+  // the reply is written blocking, with a timeout so a client that stops
+  // reading can't hold up the event loop for long
+  struct timeval timeout = {1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+  for (size_t sent = 0; sent < reply.size();) {
+    ssize_t n =
+        send(fd, reply.data() + sent, reply.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) {
+      break;
     }
-    close(msg_d);
+    sent += n;
+  }
+
+  epoll_ctl(epoll, EPOLL_CTL_DEL, fd, NULL);
+  close(fd);
+  controls.erase(fd);
+}
 
-    this->pushQueue(std::make_pair(level, msg));
+std::string Logger::controlCommand(const std::string &command) {
+  if (command == "top") {
+    if (!talkers.enabled()) {
+      return "top is disabled, start with --top-k=count\n";
+    }
+    return talkers.report();
+  }
+  if (command == "connections") {
+    return connectionReport();
+  }
+  if (command == "templates") {
+    if (!miner.enabled()) {
+      return "templates are disabled, start with --templates=path\n";
+    }
+    return miner.report();
+  }
+  if (command == "rollups") {
+    if (!rollups.enabled()) {
+      return "rollups are disabled, start with --rollups=on\n";
+    }
+    return rollups.report();
+  }
+  if (command == "traces") {
+    if (!tail.enabled()) {
+      return "traces are disabled, start with --tail-window=ms\n";
+    }
+    return tail.report();
   }
+  return "unknown command " + command +
+         ", expected top, connections, templates, rollups or traces\n";
 }
 
 void Logger::processQueue() {
   while (true) {
-    while (logqueue.empty()) {
+    if (logqueue.empty()) {
+      commitBatch();
+      writer.flush();
+      while (logqueue.empty()) {
+        if (rollups.enabled()) {
+          rollups.tick(realtime_nanoseconds());
+        }
+        if (tail.enabled()) {
+          tail.expire(realtime_nanoseconds());
+        }
+      }
     }
 
-    std::pair<uint8_t, std::string> log = this->popQueue();
-    this->commitLog(std::move(log.first), std::move(log.second));
+    LogRecord log = this->popQueue();
+    if (log.level != HEADER) {
+      redactor.apply(log.message);
+      redactor.apply(log.fields);
+      if (alerts.enabled()) {
+        alerts.apply(log);
+      }
+      if (talkers.enabled()) {
+        talker_key(log, talker);
+        talkers.add(talker);
+      }
+      if (rollups.enabled()) {
+        rollups.add(log);
+      }
+      if (miner.enabled()) {
+        log.template_id = miner.mine(log.message, log.params);
+      }
+      // alerts and rollups above still see every record tail holds back
+      if (tail.enabled() && !tail.offer(log, released)) {
+        continue;
+      }
+      for (const LogRecord &held : released) {
+        this->commitLog(held);
+      }
+      released.clear();
+    }
+    this->commitLog(log);
   }
 }
 
 Logger::~Logger() {
-  close_file(file);
+  commitBatch();
+  huge_free(batch, batch_size);
+  for (auto &conn : connections) {
+    close(conn.first);
+  }
+  close(epoll);
   close(sock);
 }
 
 /**
  * threadsafe method to add an element to logqueue
  */
-void Logger::pushQueue(std::pair<uint8_t, std::string> log) {
+void Logger::pushQueue(LogRecord log) {
   logqueuelock.lock();
 
   logqueue.push(std::move(log));
@@ -149,14 +1135,28 @@ void Logger::pushQueue(std::pair<uint8_t, std::string> log) {
   logqueuelock.unlock();
 }
 
+void Logger::pushQueue(std::vector<LogRecord> &logs) {
+  if (logs.empty()) {
+    return;
+  }
+  logqueuelock.lock();
+
+  for (LogRecord &log : logs) {
+    logqueue.push(std::move(log));
+  }
+
+  logqueuelock.unlock();
+  logs.clear();
+}
+
 /**
  * threadsafe method to extract the first element from the queue, then
  * remove it from logqueue..
  */
-std::pair<uint8_t, std::string> Logger::popQueue() {
+LogRecord Logger::popQueue() {
   logqueuelock.lock();
 
-  std::pair<uint8_t, std::string> _ret = logqueue.front();
+  LogRecord _ret = std::move(logqueue.front());
   logqueue.pop();
 
   logqueuelock.unlock();
@@ -164,52 +1164,84 @@ std::pair<uint8_t, std::string> Logger::popQueue() {
   return _ret;
 }
 
-void Logger::commitLog(uint8_t level, std::string message) {
-  auto apply = [&message](std::string colour) {
-    message = colour + message + "\e[0m";
-  };
+void Logger::commitLog(const LogRecord &log) {
+  if (log.level >= LOG_LEVELS) {
+    unknown_levels++;
+    return;
+  }
 
-  switch (level) {
-  case HEADER: {
-    if (file == STDOUT) {
-      apply("\e[0m");
-    }
-    break;
+  // the banner is written as is, everything else goes through line_format
+  const level_info_t &info = LEVELS[log.level];
+  bool colour = writer.is_stdout();
+  size_t len = (log.level == HEADER ? log.message.size()
+                                    : line_format.measure(log)) +
+               1;
+  if (colour) {
+    len += info.colour_len + COLOUR_RESET_LEN;
   }
-  case INFO: {
-    message = "Info: " + message;
-    if (file == STDOUT) {
-      apply("\e[0;36m");
-    }
-    break;
+
+  std::string spill;
+  char *record = reserveBatch(len);
+  if (record == nullptr) {
+    spill.resize(len);
+    record = &spill[0];
   }
-  case DEBUG: {
-    message = "Debug: " + message;
-    if (file == STDOUT) {
-      apply("\e[0;93m");
-    }
-    break;
+
+  char *out = record;
+  if (colour) {
+    out = (char *)mempcpy(out, info.colour, info.colour_len);
   }
-  case ERROR: {
-    message = "Error: " + message;
-    if (file == STDOUT) {
-      apply("\e[0;91m");
-    }
-    break;
+  char *line = out;
+  if (log.level == HEADER) {
+    out = (char *)mempcpy(out, log.message.data(), log.message.size());
+  } else {
+    out = line_format.format(log, out);
   }
-  default: {
-    printf("invalid log level when commiting log");
-    exit(EXIT_FAILURE);
+  bool newline = out == line || out[-1] != '\n';
+  if (colour) {
+    out = (char *)mempcpy(out, COLOUR_RESET, COLOUR_RESET_LEN);
   }
+  if (newline) {
+    *out++ = '\n';
   }
 
-  if (file == STDOUT) {
-    message += "\e[0m";
+  if (archive.enabled() && log.level != HEADER) {
+    archive.add(log);
   }
 
-  if (message[message.size() - 1] != '\n') {
-    message += "\n";
+  // a rotation during the append seals the segment before these levels
+  if (spill.empty()) {
+    batch_len -= len - (out - record);
+    batch_levels |= 1u << log.level;
+  } else {
+    writer.append(record, out - record);
+    segment_levels |= 1u << log.level;
+    archive.flush();
   }
-  char const *msg = message.c_str();
-  write(file, msg, message.size());
+}
+
+char *Logger::reserveBatch(size_t len) {
+  if (batch_len + len > batch_size) {
+    commitBatch();
+  }
+
+  if (len > batch_size) {
+    return nullptr;
+  }
+
+  char *record = batch + batch_len;
+  batch_len += len;
+  return record;
+}
+
+void Logger::commitBatch() {
+  if (batch_len == 0) {
+    return;
+  }
+
+  writer.append(batch, batch_len);
+  batch_len = 0;
+  segment_levels |= batch_levels;
+  batch_levels = 0;
+  archive.flush();
 }
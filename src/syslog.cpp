@@ -0,0 +1,228 @@
+/*
+ * Author: Elijah Mullens
+ * Date: 09/07/2024
+ */
+
+#include "syslog.hpp"
+#include "loglevel.hpp"
+
+#include <cstring>
+
+// syslog severities, emergency (0) to debug (7), as log_t
+static const uint8_t SEVERITY_LEVELS[8] = {FATAL, FATAL, FATAL, ERROR,
+                                           WARN,  INFO,  INFO,  DEBUG};
+
+#define FACILITY_USER 1
+
+/**
+ * [p, end) as a view, empty for the nil value -
+ */
+static std::string_view nil_view(const char *p, const char *end) {
+  if (end - p == 1 && *p == '-') {
+    return std::string_view();
+  }
+  return std::string_view(p, end - p);
+}
+
+/**
+ * the space separated word at p, leaving p after it and its space
+ */
+static std::string_view next_word(const char *&p, const char *end) {
+  const char *start = p;
+  const char *space = (const char *)memchr(p, ' ', end - p);
+  p = space != NULL ? space + 1 : end;
+  return nil_view(start, space != NULL ? space : end);
+}
+
+/**
+ * whether p starts with a BSD "Mmm dd hh:mm:ss " timestamp
+ */
+static bool bsd_timestamp(const char *p, const char *end) {
+  return end - p >= 16 && p[3] == ' ' && p[6] == ' ' && p[9] == ':' &&
+         p[12] == ':' && p[15] == ' ';
+}
+
+/**
+ * the end of the [id name="value"...] elements starting at p, a ] inside a
+ * quoted value doesn't close its element
+ */
+static const char *structured_end(const char *p, const char *end) {
+  while (p < end && *p == '[') {
+    bool quoted = false;
+    for (p++; p < end; p++) {
+      if (quoted && *p == '\\' && p + 1 < end) {
+        p++;
+      } else if (*p == '"') {
+        quoted = !quoted;
+      } else if (*p == ']' && !quoted) {
+        break;
+      }
+    }
+    if (p == end) {
+      return end;
+    }
+    p++;
+  }
+  return p;
+}
+
+/**
+ * parses TAG[pid]: message, without a tag ending in a colon all of [p, end)
+ * is the message
+ */
+static void parse_tag(const char *p, const char *end, syslog_msg_t &msg) {
+  const char *space = (const char *)memchr(p, ' ', end - p);
+  const char *tag_end = space != NULL ? space : end;
+  if (tag_end == p || tag_end[-1] != ':') {
+    msg.message = std::string_view(p, end - p);
+    return;
+  }
+
+  tag_end--;
+  const char *open = (const char *)memchr(p, '[', tag_end - p);
+  if (open != NULL && tag_end[-1] == ']') {
+    msg.procid = std::string_view(open + 1, tag_end - 1 - (open + 1));
+    tag_end = open;
+  }
+  msg.app = std::string_view(p, tag_end - p);
+  p = space != NULL ? space + 1 : end;
+  msg.message = std::string_view(p, end - p);
+}
+
+void parse_syslog(const char *data, size_t len, syslog_msg_t &msg) {
+  msg = syslog_msg_t();
+  const char *end = data + len;
+  while (end > data && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == 0)) {
+    end--;
+  }
+
+  // <PRI>, facility * 8 + severity in at most three digits
+  unsigned pri = 0;
+  const char *p = data + 1;
+  if (end - data >= 3 && *data == '<') {
+    for (; p < end && p - data <= 3 && *p >= '0' && *p <= '9'; p++) {
+      pri = pri * 10 + (*p - '0');
+    }
+  }
+  if (p == data + 1 || p >= end || *p != '>' || pri > 191) {
+    msg.level = SEVERITY_LEVELS[5];
+    msg.facility = FACILITY_USER;
+    msg.message = std::string_view(data, end - data);
+    return;
+  }
+  p++;
+  msg.level = SEVERITY_LEVELS[pri & 7];
+  msg.facility = pri >> 3;
+
+  // 5424: 1 TIMESTAMP HOSTNAME APP-NAME PROCID MSGID SD [MSG]
+  if (end - p >= 2 && p[0] == '1' && p[1] == ' ') {
+    p += 2;
+    next_word(p, end);
+    msg.host = next_word(p, end);
+    msg.app = next_word(p, end);
+    msg.procid = next_word(p, end);
+    msg.msgid = next_word(p, end);
+    if (p < end && *p == '-') {
+      p++;
+    } else {
+      const char *structured = p;
+      p = structured_end(p, end);
+      msg.structured = std::string_view(structured, p - structured);
+    }
+    if (p < end && *p == ' ') {
+      p++;
+    }
+    // a UTF-8 message may start with a byte order mark
+    if (end - p >= 3 && memcmp(p, "\xef\xbb\xbf", 3) == 0) {
+      p += 3;
+    }
+    msg.message = std::string_view(p, end - p);
+    return;
+  }
+
+  // 3164: [TIMESTAMP HOSTNAME ]TAG[pid]: MSG, local senders leave out the
+  // hostname, so a first word ending in a colon is taken as the tag
+  if (bsd_timestamp(p, end)) {
+    p += 16;
+    const char *space = (const char *)memchr(p, ' ', end - p);
+    if (space != NULL && space > p && space[-1] != ':') {
+      msg.host = std::string_view(p, space - p);
+      p = space + 1;
+    }
+  }
+  parse_tag(p, end, msg);
+}
+
+bool next_sd_param(std::string_view &structured, std::string_view &name,
+                   std::string_view &value) {
+  size_t i = 0;
+  while (i < structured.size()) {
+    char c = structured[i];
+    if (c == '[') {
+      // the element's SD-ID
+      while (i < structured.size() && structured[i] != ' ' &&
+             structured[i] != ']') {
+        i++;
+      }
+      continue;
+    }
+    if (c == ' ' || c == ']') {
+      i++;
+      continue;
+    }
+
+    size_t eq = structured.find('=', i);
+    if (eq == std::string_view::npos || eq + 1 >= structured.size() ||
+        structured[eq + 1] != '"') {
+      break;
+    }
+    size_t close = eq + 2;
+    while (close < structured.size() && structured[close] != '"') {
+      close += structured[close] == '\\' ? 2 : 1;
+    }
+    if (close >= structured.size()) {
+      break;
+    }
+    name = structured.substr(i, eq - i);
+    value = structured.substr(eq + 2, close - (eq + 2));
+    structured.remove_prefix(close + 1);
+    return true;
+  }
+  structured = std::string_view();
+  return false;
+}
+
+ssize_t syslog_frame(const char *data, size_t len, std::string_view &msg) {
+  if (len == 0) {
+    return 0;
+  }
+
+  if (data[0] >= '1' && data[0] <= '9') {
+    size_t count = 0;
+    size_t i = 0;
+    for (; i < len && data[i] >= '0' && data[i] <= '9'; i++) {
+      count = count * 10 + (data[i] - '0');
+      if (count > SYSLOG_FRAME_MAX) {
+        return -1;
+      }
+    }
+    if (i == len) {
+      return 0;
+    }
+    if (data[i] != ' ') {
+      return -1;
+    }
+    if (len - (i + 1) < count) {
+      return 0;
+    }
+    msg = std::string_view(data + i + 1, count);
+    return i + 1 + count;
+  }
+
+  const char *lf = (const char *)memchr(data, '\n', len);
+  if (lf == NULL) {
+    return len > SYSLOG_FRAME_MAX ? -1 : 0;
+  }
+  msg = std::string_view(data, lf - data);
+  return lf - data + 1;
+}
@@ -0,0 +1,59 @@
+#ifndef _SYSLOG_H
+#define _SYSLOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <sys/types.h>
+
+// longest octet counted frame accepted on a syslog TCP connection
+#define SYSLOG_FRAME_MAX (1 << 20)
+
+/**
+ * a syslog message, RFC 5424 or RFC 3164 (BSD), every view points into the
+ * bytes it was parsed from and is empty where the message left that part out
+ * or gave it as -
+ */
+struct syslog_msg_t {
+  // the log_t its severity maps to
+  uint8_t level;
+  uint8_t facility;
+  std::string_view host;
+  // APP-NAME, or the TAG of a BSD message
+  std::string_view app;
+  std::string_view procid;
+  std::string_view msgid;
+  // the [id name="value"...] elements as sent, 5424 only, see next_sd_param
+  std::string_view structured;
+  std::string_view message;
+};
+
+/**
+ * parses the len bytes at data into msg without copying or allocating,
+ * telling 5424 from 3164 by the version after <PRI>
+ *
+ * the timestamp is skipped, records are stamped on arrival like any other.
+ * a message without a valid <PRI> is taken whole as user.notice, as RFC 3164
+ * has relays do
+ */
+void parse_syslog(const char *data, size_t len, syslog_msg_t &msg);
+
+/**
+ * consumes the next param from the front of structured, setting name and
+ * value, value still holds any \", \\ and \] escapes
+ *
+ * returns false once there are no more
+ */
+bool next_sd_param(std::string_view &structured, std::string_view &name,
+                   std::string_view &value);
+
+/**
+ * finds the first message of a syslog TCP stream (RFC 6587) in data, either
+ * octet counted as "<len> <message>" or terminated by a newline
+ *
+ * returns the bytes the frame takes up with its message in msg, 0 if it
+ * hasn't fully arrived, -1 if the stream is malformed
+ */
+ssize_t syslog_frame(const char *data, size_t len, std::string_view &msg);
+
+#endif // _SYSLOG_H
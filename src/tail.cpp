@@ -0,0 +1,103 @@
+/*
+ * Author: Elijah Mullens
+ * Date: 09/07/2024
+ */
+
+#include "tail.hpp"
+#include "loglevel.hpp"
+
+#include <cstring>
+
+/**
+ * roughly the memory a held record takes up
+ */
+static size_t footprint(const LogRecord &record) {
+  return sizeof(record) + record.source.capacity() +
+         record.fields.capacity() + record.message.capacity() +
+         record.params.capacity();
+}
+
+TailSampler::TailSampler(uint64_t window, size_t budget)
+    : window(window * 1000000), budget(budget), bytes(0), held_count(0),
+      held_bytes(0), kept(0), dropped(0) {}
+
+bool TailSampler::enabled() const { return window > 0; }
+
+bool TailSampler::offer(LogRecord &record, std::vector<LogRecord> &released) {
+  expire(record.time);
+  if (record.level >= LOG_LEVELS ||
+      !id_is_set(record.trace.trace_id, TRACE_ID_LEN)) {
+    return true;
+  }
+  uint8_t severity = LEVELS[record.level].severity;
+  bool low = severity < LEVELS[INFO].severity;
+  bool failed = severity >= LEVELS[ERROR].severity;
+  if (!low && !failed) {
+    return true;
+  }
+
+  trace_key_t key;
+  memcpy(&key, record.trace.trace_id, sizeof(key));
+  auto found = traces.find(key);
+  if (found == traces.end()) {
+    uint64_t deadline = record.time + window;
+    found = traces.emplace(key, trace_t{deadline, false, {}, 0}).first;
+    deadlines.emplace_back(deadline, key);
+  }
+  trace_t &trace = found->second;
+
+  if (failed && !trace.kept) {
+    trace.kept = true;
+    kept += trace.held.size();
+    held_count -= trace.held.size();
+    held_bytes -= trace.bytes;
+    bytes -= trace.bytes;
+    for (LogRecord &held : trace.held) {
+      released.push_back(std::move(held));
+    }
+    trace.held.clear();
+    trace.held.shrink_to_fit();
+    trace.bytes = 0;
+  }
+  if (trace.kept) {
+    return true;
+  }
+
+  size_t size = footprint(record);
+  trace.held.push_back(std::move(record));
+  trace.bytes += size;
+  bytes += size;
+  held_count++;
+  held_bytes += size;
+  while (bytes > budget) {
+    dropOldest();
+  }
+  return false;
+}
+
+void TailSampler::expire(uint64_t now) {
+  while (!deadlines.empty() && deadlines.front().first <= now) {
+    dropOldest();
+  }
+}
+
+void TailSampler::dropOldest() {
+  auto found = traces.find(deadlines.front().second);
+  if (found != traces.end() &&
+      found->second.deadline == deadlines.front().first) {
+    trace_t &trace = found->second;
+    dropped += trace.held.size();
+    held_count -= trace.held.size();
+    held_bytes -= trace.bytes;
+    bytes -= trace.bytes;
+    traces.erase(found);
+  }
+  deadlines.pop_front();
+}
+
+std::string TailSampler::report() const {
+  return "traces " + std::to_string(held_count.load()) +
+         " records held in " + std::to_string(held_bytes.load()) +
+         " bytes, " + std::to_string(kept.load()) + " kept, " +
+         std::to_string(dropped.load()) + " dropped\n";
+}
@@ -0,0 +1,97 @@
+#ifndef _TAIL_H
+#define _TAIL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "logrecord.hpp"
+
+/**
+ * tail-based retention by trace id
+ *
+ * DEBUG and TRACE records that carry a trace id are held back per trace for
+ * window from the trace's first record. an ERROR or FATAL record of the
+ * trace in that time releases them, to be written just ahead of it, and the
+ * rest of the trace's window passes straight through. a trace that sees no
+ * error by the end of its window has its held records dropped. records
+ * without a trace id and those of every other level are never held
+ *
+ * held records take up at most budget bytes, past it the oldest trace is
+ * dropped early
+ */
+class TailSampler {
+public:
+  /**
+   * retention is off if window, in milliseconds, is 0
+   */
+  TailSampler(uint64_t window, size_t budget);
+
+  bool enabled() const;
+
+  /**
+   * returns false if record was held, otherwise it is written after the
+   * records moved into released, queue thread only
+   */
+  bool offer(LogRecord &record, std::vector<LogRecord> &released);
+
+  /**
+   * drops the records of traces whose window closed by now, in nanoseconds
+   * since the epoch, queue thread only
+   */
+  void expire(uint64_t now);
+
+  /**
+   * "traces <held> records held in <bytes> bytes, <kept> kept, <dropped>
+   * dropped", threadsafe
+   */
+  std::string report() const;
+
+private:
+  struct trace_key_t {
+    uint64_t hi;
+    uint64_t lo;
+
+    bool operator==(const trace_key_t &other) const {
+      return hi == other.hi && lo == other.lo;
+    }
+  };
+
+  // trace ids are random, so any half of one is already a good hash
+  struct trace_hash {
+    size_t operator()(const trace_key_t &key) const { return key.lo; }
+  };
+
+  struct trace_t {
+    // nanoseconds since the epoch
+    uint64_t deadline;
+    // an error arrived, the trace's records pass straight through
+    bool kept;
+    std::vector<LogRecord> held;
+    size_t bytes;
+  };
+
+  uint64_t window;
+  size_t budget;
+  size_t bytes;
+  std::unordered_map<trace_key_t, trace_t, trace_hash> traces;
+  // every trace by deadline, the order they were first seen in
+  std::deque<std::pair<uint64_t, trace_key_t>> deadlines;
+
+  std::atomic<uint64_t> held_count;
+  std::atomic<uint64_t> held_bytes;
+  std::atomic<uint64_t> kept;
+  std::atomic<uint64_t> dropped;
+
+  /**
+   * forgets the oldest trace, dropping anything it holds
+   */
+  void dropOldest();
+};
+
+#endif // _TAIL_H
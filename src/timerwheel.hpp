@@ -0,0 +1,57 @@
+#ifndef _TIMERWHEEL_H
+#define _TIMERWHEEL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <utility>
+#include <vector>
+
+/**
+ * a hashed timing wheel with one second slots, used to find idle connections
+ * without keeping them sorted by deadline
+ *
+ * entries are only candidates, the owner rechecks each one when it comes due
+ * and reschedules it if it saw activity since, so touching a connection never
+ * costs more than updating its timestamp
+ */
+class TimerWheel {
+public:
+  // (fd, connection id), the id guards against a reused fd
+  typedef std::pair<ssize_t, uint64_t> entry_t;
+
+  TimerWheel(size_t slots, time_t now) : slots(slots), hand(now) {}
+
+  /**
+   * places entry in the slot for deadline, deadlines further out than the
+   * wheel spans come due early and are expected to be rescheduled
+   */
+  void schedule(entry_t entry, time_t deadline) {
+    if (deadline <= hand) {
+      deadline = hand + 1;
+    }
+    slots[deadline % slots.size()].push_back(entry);
+  }
+
+  /**
+   * moves the hand up to now, appending every entry it passes to due
+   */
+  void advance(time_t now, std::vector<entry_t> &due) {
+    // after a long stall every slot is due anyway, so one lap is enough
+    hand = std::max(hand, now - (time_t)slots.size());
+
+    while (hand < now) {
+      hand++;
+      std::vector<entry_t> &slot = slots[hand % slots.size()];
+      due.insert(due.end(), slot.begin(), slot.end());
+      slot.clear();
+    }
+  }
+
+private:
+  std::vector<std::vector<entry_t>> slots;
+  time_t hand;
+};
+
+#endif // _TIMERWHEEL_H
@@ -0,0 +1,125 @@
+/*
+ * Author: Elijah Mullens
+ * Date: 09/07/2024
+ */
+
+#include "topk.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+void talker_key(const LogRecord &record, std::string &key) {
+  key.assign(record.source);
+  key += ' ';
+
+  size_t limit = key.size() + TALKER_KEY_LEN;
+  bool digits = false;
+  for (char c : record.message) {
+    if (key.size() == limit) {
+      break;
+    }
+    if (c >= '0' && c <= '9') {
+      if (!digits) {
+        key += '#';
+      }
+      digits = true;
+      continue;
+    }
+    digits = false;
+    key += c == '\n' ? ' ' : c;
+  }
+}
+
+TopTalkers::TopTalkers(size_t capacity) : capacity(capacity), total(0) {
+  heap.reserve(capacity);
+  index.reserve(capacity);
+}
+
+bool TopTalkers::enabled() const { return capacity > 0; }
+
+void TopTalkers::add(const std::string &key) {
+  std::lock_guard<std::mutex> guard(lock);
+  total++;
+
+  auto found = index.find(key);
+  if (found != index.end()) {
+    heap[found->second].count++;
+    siftDown(found->second);
+    return;
+  }
+
+  if (heap.size() < capacity) {
+    index[key] = heap.size();
+    heap.push_back({key, 1, 0});
+    siftUp(heap.size() - 1);
+    return;
+  }
+
+  // evict the smallest counter, its count becomes the new key's error
+  index.erase(heap[0].key);
+  heap[0].key = key;
+  heap[0].error = heap[0].count;
+  heap[0].count++;
+  index[key] = 0;
+  siftDown(0);
+}
+
+void TopTalkers::siftUp(size_t i) {
+  while (i > 0 && heap[(i - 1) / 2].count > heap[i].count) {
+    size_t parent = (i - 1) / 2;
+    std::swap(heap[i], heap[parent]);
+    index[heap[i].key] = i;
+    index[heap[parent].key] = parent;
+    i = parent;
+  }
+}
+
+void TopTalkers::siftDown(size_t i) {
+  while (true) {
+    size_t smallest = i;
+    size_t left = 2 * i + 1;
+    size_t right = left + 1;
+    if (left < heap.size() && heap[left].count < heap[smallest].count) {
+      smallest = left;
+    }
+    if (right < heap.size() && heap[right].count < heap[smallest].count) {
+      smallest = right;
+    }
+    if (smallest == i) {
+      return;
+    }
+
+    std::swap(heap[i], heap[smallest]);
+    index[heap[i].key] = i;
+    index[heap[smallest].key] = smallest;
+    i = smallest;
+  }
+}
+
+std::string TopTalkers::report() {
+  std::vector<entry_t> entries;
+  uint64_t seen;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    entries = heap;
+    seen = total;
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const entry_t &a, const entry_t &b) {
+              return a.count > b.count;
+            });
+
+  char line[64];
+  snprintf(line, sizeof(line), "top %zu of %lu records\n", entries.size(),
+           (unsigned long)seen);
+  std::string report(line);
+
+  for (const entry_t &entry : entries) {
+    snprintf(line, sizeof(line), "%lu %lu ", (unsigned long)entry.count,
+             (unsigned long)entry.error);
+    report += line;
+    report += entry.key;
+    report += '\n';
+  }
+  return report;
+}
@@ -0,0 +1,73 @@
+#ifndef _TOPK_H
+#define _TOPK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "logrecord.hpp"
+
+// longest template kept as a key, the rest of the message is ignored
+#define TALKER_KEY_LEN 80
+
+/**
+ * builds the key a record is counted under: its source and the start of its
+ * message with every run of digits replaced by #, so "took 12ms" and "took
+ * 7ms" from the same sender are the same statement
+ */
+void talker_key(const LogRecord &record, std::string &key);
+
+/**
+ * the approximate top K keys of a stream in constant memory (SpaceSaving)
+ *
+ * K counters are kept in a min-heap, an unseen key evicts the smallest one
+ * and inherits its count, remembered as the key's error. every key seen more
+ * than total / K times is guaranteed to be present, and each count over
+ * estimates the true one by at most its error
+ */
+class TopTalkers {
+public:
+  struct entry_t {
+    std::string key;
+    uint64_t count;
+    uint64_t error;
+  };
+
+  TopTalkers(size_t capacity);
+
+  /**
+   * counts one occurrence of key, threadsafe
+   */
+  void add(const std::string &key);
+
+  /**
+   * "top <n> of <total> records" followed by one "<count> <error> <key>" line
+   * per tracked key, by descending count
+   */
+  std::string report();
+
+  bool enabled() const;
+
+private:
+  size_t capacity;
+  uint64_t total;
+  std::vector<entry_t> heap;
+  // key -> position in heap
+  std::unordered_map<std::string, size_t> index;
+  std::mutex lock;
+
+  /**
+   * restores the heap above i after heap[i] was added
+   */
+  void siftUp(size_t i);
+
+  /**
+   * restores the heap below i after heap[i] grew
+   */
+  void siftDown(size_t i);
+};
+
+#endif // _TOPK_H
@@ -0,0 +1,71 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#define TRACE_ID_LEN 16
+#define SPAN_ID_LEN 8
+
+/**
+ * the W3C trace context of a record, sent as ,trace=<32 hex>,span=<16 hex>
+ * and kept as bytes, an id of all zeros means there is none
+ */
+struct trace_context_t {
+  uint8_t trace_id[TRACE_ID_LEN];
+  uint8_t span_id[SPAN_ID_LEN];
+};
+
+inline bool id_is_set(const uint8_t *id, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (id[i] != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * writes the len bytes of id as 2 * len lowercase hex digits
+ */
+inline char *fmt_hex_id(char *out, const uint8_t *id, size_t len) {
+  static const char digits[] = "0123456789abcdef";
+  for (size_t i = 0; i < len; i++) {
+    *out++ = digits[id[i] >> 4];
+    *out++ = digits[id[i] & 0xf];
+  }
+  return out;
+}
+
+/**
+ * parses [p, end), exactly 2 * len hex digits, into id
+ *
+ * returns false, leaving id as it was, if it isn't
+ */
+inline bool parse_hex_id(const char *p, const char *end, uint8_t *id,
+                         size_t len) {
+  if ((size_t)(end - p) != 2 * len) {
+    return false;
+  }
+  uint8_t parsed[TRACE_ID_LEN];
+  for (size_t i = 0; i < 2 * len; i++) {
+    char c = p[i];
+    uint8_t nibble;
+    if (c >= '0' && c <= '9') {
+      nibble = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      nibble = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      nibble = c - 'A' + 10;
+    } else {
+      return false;
+    }
+    parsed[i / 2] = i % 2 == 0 ? nibble << 4 : parsed[i / 2] | nibble;
+  }
+  for (size_t i = 0; i < len; i++) {
+    id[i] = parsed[i];
+  }
+  return true;
+}
+
+#endif // _TRACE_H
@@ -0,0 +1,263 @@
+/*
+ * Author: Elijah Mullens
+ * Date: 09/07/2024
+ *
+ * [Description]
+ * Checks log segments written by logserver --checksum=on against the frames
+ * in their <segment>.crc. Each thread checks one contiguous run of a
+ * segment's frames, so the segment is read sequentially and in parallel.
+ * Every bad block is reported, a block that runs past the end of the segment
+ * is a torn write. Data past the last frame isn't covered by any checksum
+ * and fails the segment too. A check runs at the slower of the disk's
+ * sequential reads and the crc32c on the cores it has, with a thread per
+ * core one thread's reads and checks don't overlap, see logbench verify.
+ *
+ * [Format]
+ * ./logverify [options...] segment...
+ *
+ * [Options]
+ * - --threads=n :- number of checking threads (default one per core)
+ * - --salvage=on|off :- copy the blocks that check out, in order, to
+ *   <segment>.salvaged (default off)
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "crc32c.hpp"
+#include "logwriter.hpp"
+
+#define SALVAGE_SUFFIX ".salvaged"
+
+struct Options {
+  size_t threads = 0;
+  bool salvage = false;
+};
+
+void parse_option(Options &options, char *option) {
+  std::string opt(option);
+  size_t eq = opt.find('=');
+  if (eq == std::string::npos) {
+    fprintf(stderr, "invalid option %s\n", option);
+    exit(EXIT_FAILURE);
+  }
+
+  std::string key = opt.substr(2, eq - 2);
+  std::string value = opt.substr(eq + 1);
+
+  if (key == "threads") {
+    char *end;
+    errno = 0;
+    options.threads = strtoull(value.c_str(), &end, 10);
+    if (errno != 0 || end == value.c_str() || *end != '\0') {
+      fprintf(stderr, "threads must be a number\n");
+      exit(EXIT_FAILURE);
+    }
+  } else if (key == "salvage") {
+    if (value == "on") {
+      options.salvage = true;
+    } else if (value == "off") {
+      options.salvage = false;
+    } else {
+      fprintf(stderr, "salvage must be on or off\n");
+      exit(EXIT_FAILURE);
+    }
+  } else {
+    fprintf(stderr, "unknown option %s\n", key.c_str());
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * reads every whole frame of path, a frame torn by a crash ends the file
+ *
+ * returns false if path can't be read
+ */
+bool load_frames(const std::string &path,
+                 std::vector<checksum_frame_t> &frames) {
+  FILE *file = fopen(path.c_str(), "r");
+  if (file == nullptr) {
+    return false;
+  }
+
+  checksum_frame_t frame;
+  while (fread(&frame, sizeof(frame), 1, file) == 1) {
+    frames.push_back(frame);
+  }
+  fclose(file);
+  return true;
+}
+
+/**
+ * where the data of a segment ends, a crashed mmap session leaves zeros past
+ * it that no frame covers
+ */
+off_t data_end(int file, off_t size) {
+  char buf[4096];
+  while (size > 0) {
+    off_t start = size > (off_t)sizeof(buf) ? size - sizeof(buf) : 0;
+    ssize_t bytes = pread(file, buf, size - start, start);
+    if (bytes <= 0) {
+      break;
+    }
+    for (ssize_t i = bytes - 1; i >= 0; i--) {
+      if (buf[i] != '\0') {
+        return start + i + 1;
+      }
+    }
+    size = start;
+  }
+  return size;
+}
+
+/**
+ * checks frames [begin, end) against the segment, setting ok for each
+ */
+void check_frames(int file, off_t size,
+                  const std::vector<checksum_frame_t> &frames,
+                  std::vector<char> &ok, size_t begin, size_t end) {
+  std::string block;
+  for (size_t i = begin; i < end; i++) {
+    const checksum_frame_t &frame = frames[i];
+    if (frame.offset + frame.len > (uint64_t)size) {
+      ok[i] = false;
+      continue;
+    }
+
+    block.resize(frame.len);
+    ssize_t bytes = pread(file, &block[0], frame.len, frame.offset);
+    ok[i] = bytes == (ssize_t)frame.len &&
+            crc32c(0, block.data(), block.size()) == frame.crc;
+  }
+}
+
+/**
+ * copies the blocks that checked out to path + SALVAGE_SUFFIX
+ */
+void salvage(const std::string &path, int file,
+             const std::vector<checksum_frame_t> &frames,
+             const std::vector<char> &ok) {
+  std::string out = path + SALVAGE_SUFFIX;
+  int salvaged = open(out.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (salvaged < 0) {
+    perror("couldn't create salvage file");
+    return;
+  }
+
+  std::string block;
+  uint64_t total = 0;
+  for (size_t i = 0; i < frames.size(); i++) {
+    if (!ok[i]) {
+      continue;
+    }
+    block.resize(frames[i].len);
+    if (pread(file, &block[0], block.size(), frames[i].offset) !=
+            (ssize_t)block.size() ||
+        write(salvaged, block.data(), block.size()) != (ssize_t)block.size()) {
+      perror("couldn't salvage block");
+      break;
+    }
+    total += block.size();
+  }
+  close(salvaged);
+  printf("%s: salvaged %lu bytes to %s\n", path.c_str(),
+         (unsigned long)total, out.c_str());
+}
+
+/**
+ * checks one segment, returns false if it's unreadable, has a bad block or
+ * has data no frame covers
+ */
+bool verify(const std::string &path, const Options &options) {
+  std::vector<checksum_frame_t> frames;
+  if (!load_frames(path + CHECKSUM_SUFFIX, frames)) {
+    fprintf(stderr, "couldn't read %s%s\n", path.c_str(), CHECKSUM_SUFFIX);
+    return false;
+  }
+  int file = open(path.c_str(), O_RDONLY);
+  struct stat st;
+  if (file < 0 || fstat(file, &st) < 0) {
+    fprintf(stderr, "couldn't read %s\n", path.c_str());
+    if (file >= 0) {
+      close(file);
+    }
+    return false;
+  }
+
+  size_t threads = options.threads;
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  threads = std::max(std::min(threads, frames.size()), (size_t)1);
+
+  std::vector<char> ok(frames.size());
+  std::vector<std::thread> pool;
+  size_t per_thread = (frames.size() + threads - 1) / threads;
+  for (size_t begin = 0; begin < frames.size(); begin += per_thread) {
+    size_t end = std::min(begin + per_thread, frames.size());
+    pool.emplace_back(check_frames, file, st.st_size, std::cref(frames),
+                      std::ref(ok), begin, end);
+  }
+  for (std::thread &thread : pool) {
+    thread.join();
+  }
+
+  size_t good = 0;
+  uint64_t checked = 0;
+  for (size_t i = 0; i < frames.size(); i++) {
+    const checksum_frame_t &frame = frames[i];
+    bool torn = frame.offset + frame.len > (uint64_t)st.st_size;
+    if (ok[i]) {
+      good++;
+    } else {
+      printf("%s: bad block at %lu, %u bytes%s\n", path.c_str(),
+             (unsigned long)frame.offset, frame.len, torn ? " (torn)" : "");
+    }
+    if (!torn) {
+      checked += frame.len;
+    }
+  }
+  uint64_t end = data_end(file, st.st_size);
+  printf("%s: %zu blocks ok, %zu bad, %lu bytes unchecked\n", path.c_str(),
+         good, frames.size() - good,
+         (unsigned long)(std::max(end, checked) - checked));
+
+  if (options.salvage) {
+    salvage(path, file, frames, ok);
+  }
+  close(file);
+  return good == frames.size() && end <= checked;
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  std::vector<std::string> paths;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--", 2) == 0) {
+      parse_option(options, argv[i]);
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty()) {
+    fprintf(stderr, "usage: %s [options...] segment...\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  int status = EXIT_SUCCESS;
+  for (const std::string &path : paths) {
+    if (!verify(path, options)) {
+      status = EXIT_FAILURE;
+    }
+  }
+  return status;
+}
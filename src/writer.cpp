@@ -0,0 +1,554 @@
+/*
+ * Author: Elijah Mullens
+ * Date: 09/07/2024
+ */
+
+#include "logwriter.hpp"
+#include "crc32c.hpp"
+#include "hugepage.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DIRECT_ALIGN 4096
+
+/**
+ * ensures that file is not STDOUT before closing, otherwise leaving untouched
+ *
+ * parameters:
+ * - file (FILE *): file to be checked then closed
+ */
+static void close_file(ssize_t file) {
+  if (STDOUT_FILENO != file) {
+    close(file);
+  }
+}
+
+/**
+ * writes the whole buffer, retrying on short writes and EINTR
+ */
+static void write_all(ssize_t file, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t bytes = write(file, buf, len);
+    if (bytes < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("couldn't write log");
+      return;
+    }
+    buf += bytes;
+    len -= bytes;
+  }
+}
+
+static size_t align_up(size_t n) {
+  return (n + DIRECT_ALIGN - 1) & ~(size_t)(DIRECT_ALIGN - 1);
+}
+
+static off_t align_down(off_t n) { return n & ~(off_t)(DIRECT_ALIGN - 1); }
+
+/**
+ * finds the sequence number for the next rotated segment of name, one past
+ * the highest <name>.<seq> already in its directory
+ */
+static unsigned long next_seq(std::string &name) {
+  size_t slash = name.rfind('/');
+  std::string dir = slash == std::string::npos ? "." : name.substr(0, slash);
+  std::string prefix =
+      (slash == std::string::npos ? name : name.substr(slash + 1)) + ".";
+
+  unsigned long seq = 1;
+  DIR *d = opendir(dir.c_str());
+  if (d == NULL) {
+    return seq;
+  }
+
+  struct dirent *entry;
+  while ((entry = readdir(d)) != NULL) {
+    if (strncmp(entry->d_name, prefix.c_str(), prefix.size()) != 0) {
+      continue;
+    }
+    const char *digits = entry->d_name + prefix.size();
+    if (*digits < '0' || *digits > '9') {
+      continue;
+    }
+    seq = std::max(seq, strtoul(digits, NULL, 10) + 1);
+  }
+  closedir(d);
+
+  return seq;
+}
+
+/**
+ * a crashed mmap session leaves its preallocated tail as zeros, every record
+ * is written ending in a newline (see Logger::commitLog), so the logical size
+ * is just past the last non zero byte
+ */
+static off_t trim_zeros(ssize_t file, off_t size) {
+  char buf[DIRECT_ALIGN];
+  while (size > 0) {
+    off_t start = align_down(size - 1);
+    ssize_t bytes = pread(file, buf, size - start, start);
+    if (bytes <= 0) {
+      break;
+    }
+    for (ssize_t i = bytes - 1; i >= 0; i--) {
+      if (buf[i] != '\0') {
+        return start + i + 1;
+      }
+    }
+    size = start;
+  }
+  return size;
+}
+
+/**
+ * the end of the last append recorded in the frames at path whose bytes in
+ * file check out, 0 if none do. frames aren't synced with their bytes, so
+ * the last few may describe bytes that never reached the disk
+ */
+static off_t framed_size(ssize_t file, off_t size, const std::string &path) {
+  int frames = open(path.c_str(), O_RDONLY);
+  if (frames < 0) {
+    return 0;
+  }
+
+  struct stat st;
+  off_t end = 0;
+  std::string bytes;
+  if (fstat(frames, &st) == 0) {
+    // a torn last frame is ignored
+    for (off_t at = st.st_size / sizeof(checksum_frame_t); at-- > 0;) {
+      checksum_frame_t frame;
+      if (pread(frames, &frame, sizeof(frame), at * sizeof(frame)) !=
+          (ssize_t)sizeof(frame)) {
+        break;
+      }
+      if ((off_t)(frame.offset + frame.len) > size) {
+        continue;
+      }
+      bytes.resize(frame.len);
+      if (pread(file, &bytes[0], frame.len, frame.offset) ==
+              (ssize_t)frame.len &&
+          crc32c(0, bytes.data(), frame.len) == frame.crc) {
+        end = frame.offset + frame.len;
+        break;
+      }
+    }
+  }
+  close(frames);
+  return end;
+}
+
+LogWriter::LogWriter(const LoggerConfig &config)
+    : name(config.name), mode(config.write_mode),
+      block_size(config.block_size), segment_size(config.segment_size),
+      rotate_size(config.rotate_size), hugepages(config.hugepages), seq(1),
+      checksum(config.checksum), frames(-1), size(0), synced(0), dropped(0),
+      blocks{nullptr, nullptr}, active(0), fill(0), block_off(0),
+      dirty(false), inflight(false), inflight_block(nullptr), inflight_off(0),
+      stopping(false), map(nullptr), map_off(0), committed(0) {
+  if (block_size == 0 || block_size % DIRECT_ALIGN != 0 ||
+      segment_size == 0 || segment_size % DIRECT_ALIGN != 0) {
+    fprintf(stderr, "block and segment sizes must be multiples of %d\n",
+            DIRECT_ALIGN);
+    exit(EXIT_FAILURE);
+  }
+
+  if (name == "stdout") {
+    file = STDOUT_FILENO;
+    mode = write_mode_t::APPEND;
+    rotate_size = 0;
+    return;
+  }
+
+  seq = next_seq(name);
+  openFile();
+  openFrames();
+}
+
+void LogWriter::openFile() {
+  if (mode == write_mode_t::DIRECT) {
+    openDirect();
+    if (mode == write_mode_t::DIRECT) {
+      return;
+    }
+  }
+
+  if (mode == write_mode_t::MMAP) {
+    openMapped();
+    return;
+  }
+
+  if ((file = open(name.c_str(), O_WRONLY | O_APPEND | O_CREAT,
+                   S_IRUSR | S_IWUSR)) < 0) {
+    perror("couldn't create file in append mode");
+    exit(EXIT_FAILURE);
+  }
+
+  size = synced = dropped = lseek(file, 0, SEEK_END);
+}
+
+void LogWriter::closeFile() {
+  switch (mode) {
+  case write_mode_t::APPEND: {
+    break;
+  }
+  case write_mode_t::FADVISE: {
+    fdatasync(file);
+    posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+    break;
+  }
+  case write_mode_t::DIRECT: {
+    waitFlusher();
+    flush();
+    break;
+  }
+  case write_mode_t::MMAP: {
+    unmapSegment();
+    if (ftruncate(file, size) < 0) {
+      perror("couldn't truncate log file");
+    }
+    break;
+  }
+  }
+
+  close_file(file);
+  if (frames >= 0) {
+    close(frames);
+    frames = -1;
+  }
+}
+
+void LogWriter::openFrames() {
+  if (!checksum) {
+    return;
+  }
+  if ((frames = open((name + CHECKSUM_SUFFIX).c_str(),
+                     O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR)) < 0) {
+    perror("couldn't open checksum file");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * opens name with O_DIRECT and loads its unaligned tail into the active
+ * block, falls back to FADVISE if the filesystem refuses O_DIRECT (e.g. tmpfs)
+ */
+void LogWriter::openDirect() {
+  if ((file = open(name.c_str(), O_RDWR | O_CREAT | O_DIRECT,
+                   S_IRUSR | S_IWUSR)) < 0) {
+    if (errno != EINVAL) {
+      perror("couldn't create file for direct io");
+      exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "O_DIRECT unsupported for %s, using fadvise\n",
+            name.c_str());
+    mode = write_mode_t::FADVISE;
+    return;
+  }
+
+  if (blocks[0] == nullptr) {
+    for (int i = 0; i < 2; i++) {
+      if ((blocks[i] = (char *)huge_alloc(block_size, hugepages)) == nullptr) {
+        fprintf(stderr, "couldn't allocate direct io blocks\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    flusher = std::thread(&LogWriter::flushBlocks, this);
+  }
+
+  struct stat st;
+  if (fstat(file, &st) < 0) {
+    perror("couldn't stat log file");
+    exit(EXIT_FAILURE);
+  }
+  size = st.st_size;
+  block_off = align_down(size);
+  fill = size - block_off;
+  dirty = false;
+  if (fill > 0 && pread(file, blocks[active], DIRECT_ALIGN, block_off) < 0) {
+    perror("couldn't read log tail");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void LogWriter::append(const char *buf, size_t len) {
+  if (rotate_size > 0 && size > 0 && size + len > rotate_size) {
+    rotate();
+  }
+
+  off_t start = size;
+  switch (mode) {
+  case write_mode_t::APPEND: {
+    write_all(file, buf, len);
+    size += len;
+    break;
+  }
+  case write_mode_t::FADVISE: {
+    write_all(file, buf, len);
+    size += len;
+    advise();
+    break;
+  }
+  case write_mode_t::DIRECT: {
+    directAppend(buf, len);
+    break;
+  }
+  case write_mode_t::MMAP: {
+    mappedAppend(buf, len);
+    break;
+  }
+  }
+
+  if (frames >= 0) {
+    checksum_frame_t frame = {(uint64_t)start, (uint32_t)len,
+                              crc32c(0, buf, len)};
+    write_all(frames, (const char *)&frame, sizeof(frame));
+  }
+}
+
+/**
+ * starts writeback of each newly completed block and drops the block before
+ * it from the page cache, lagging one block behind so the queue thread never
+ * waits on its own writeback
+ *
+ * the dropped block's writeback was started a block ago, WAIT_BEFORE lets it
+ * finish so DONTNEED can evict the pages, WRITE catches any page redirtied
+ * since and isn't waited on, a page still under writeback just stays cached
+ */
+void LogWriter::advise() {
+  while (size - synced >= (off_t)block_size) {
+    sync_file_range(file, synced, block_size, SYNC_FILE_RANGE_WRITE);
+    synced += block_size;
+
+    if (synced - dropped > (off_t)block_size) {
+      sync_file_range(file, dropped, block_size,
+                      SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE);
+      posix_fadvise(file, dropped, block_size, POSIX_FADV_DONTNEED);
+      dropped += block_size;
+    }
+  }
+}
+
+void LogWriter::directAppend(const char *buf, size_t len) {
+  size += len;
+  while (len > 0) {
+    size_t n = std::min(len, block_size - fill);
+    memcpy(blocks[active] + fill, buf, n);
+    fill += n;
+    buf += n;
+    len -= n;
+    dirty = true;
+
+    if (fill < block_size) {
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(flushlock);
+    flushcv.wait(lock, [this] { return !inflight; });
+    inflight = true;
+    inflight_block = blocks[active];
+    inflight_off = block_off;
+    flushcv.notify_all();
+
+    active ^= 1;
+    block_off += block_size;
+    fill = 0;
+    dirty = false;
+  }
+}
+
+void LogWriter::flushBlocks() {
+  std::unique_lock<std::mutex> lock(flushlock);
+  while (true) {
+    flushcv.wait(lock, [this] { return inflight || stopping; });
+    if (!inflight) {
+      return;
+    }
+
+    char *block = inflight_block;
+    off_t off = inflight_off;
+    lock.unlock();
+    if (pwrite(file, block, block_size, off) < 0) {
+      perror("couldn't write log block");
+    }
+    lock.lock();
+
+    inflight = false;
+    flushcv.notify_all();
+  }
+}
+
+void LogWriter::waitFlusher() {
+  std::unique_lock<std::mutex> lock(flushlock);
+  flushcv.wait(lock, [this] { return !inflight; });
+}
+
+/**
+ * opens name for mapping, recovering the logical size of a file left with a
+ * preallocated tail, and maps the segment containing its end
+ *
+ * with checksums the size is also recovered from the frames, and the larger
+ * of the two is kept: the frames' count even if the bytes end in NUL, the
+ * scan's even if the frames were lost
+ */
+void LogWriter::openMapped() {
+  if ((file = open(name.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR)) < 0) {
+    perror("couldn't create file for mapping");
+    exit(EXIT_FAILURE);
+  }
+
+  struct stat st;
+  if (fstat(file, &st) < 0) {
+    perror("couldn't stat log file");
+    exit(EXIT_FAILURE);
+  }
+  size = trim_zeros(file, st.st_size);
+  if (checksum) {
+    size = std::max(size,
+                    framed_size(file, st.st_size, name + CHECKSUM_SUFFIX));
+  }
+  committed = size;
+  mapSegment(align_down(size));
+}
+
+/**
+ * preallocates [off, off + segment_size) in one extent and maps it, so the
+ * file only grows once per segment rather than on every record
+ */
+void LogWriter::mapSegment(off_t off) {
+  int err = posix_fallocate(file, off, segment_size);
+  if (err != 0) {
+    errno = err;
+    perror("couldn't preallocate log segment");
+    exit(EXIT_FAILURE);
+  }
+
+  void *addr = mmap(NULL, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    file, off);
+  if (addr == MAP_FAILED) {
+    perror("couldn't map log segment");
+    exit(EXIT_FAILURE);
+  }
+
+  map = (char *)addr;
+  map_off = off;
+}
+
+void LogWriter::unmapSegment() {
+  if (map == nullptr) {
+    return;
+  }
+
+  flush();
+  munmap(map, segment_size);
+  map = nullptr;
+}
+
+void LogWriter::mappedAppend(const char *buf, size_t len) {
+  while (len > 0) {
+    if (size == map_off + (off_t)segment_size) {
+      unmapSegment();
+      mapSegment(size);
+    }
+
+    size_t n = std::min(len, (size_t)(map_off + segment_size - size));
+    memcpy(map + (size - map_off), buf, n);
+    size += n;
+    buf += n;
+    len -= n;
+  }
+}
+
+/**
+ * DIRECT: O_DIRECT can only write whole aligned sectors, so the partial block
+ * is written padded with zeros and the file truncated back to its logical
+ * size, the next flush rewrites the same block in place. that is a
+ * synchronous write and a metadata update on every drain
+ *
+ * MMAP: msyncs the pages dirtied since the last commit
+ */
+void LogWriter::flush() {
+  if (mode == write_mode_t::MMAP) {
+    if (map == nullptr || committed == size) {
+      return;
+    }
+
+    off_t start = align_down(std::max(committed, map_off));
+    if (msync(map + (start - map_off), size - start, MS_SYNC) < 0) {
+      perror("couldn't sync log segment");
+    }
+    committed = size;
+    return;
+  }
+
+  if (mode != write_mode_t::DIRECT || !dirty) {
+    return;
+  }
+
+  // the pad still holds an older block's text, zeros are all a reader or a
+  // crash before the truncate can see
+  memset(blocks[active] + fill, 0, align_up(fill) - fill);
+  if (pwrite(file, blocks[active], align_up(fill), block_off) < 0) {
+    perror("couldn't write log block");
+  }
+  if (ftruncate(file, block_off + fill) < 0) {
+    perror("couldn't truncate log file");
+  }
+  dirty = false;
+}
+
+void LogWriter::rotate() {
+  if (is_stdout()) {
+    return;
+  }
+
+  closeFile();
+
+  std::string rotated = name + "." + std::to_string(seq++);
+  if (rename(name.c_str(), rotated.c_str()) < 0) {
+    perror("couldn't rotate log file");
+  }
+  if (checksum && rename((name + CHECKSUM_SUFFIX).c_str(),
+                         (rotated + CHECKSUM_SUFFIX).c_str()) < 0) {
+    perror("couldn't rotate checksum file");
+  }
+  if (rotate_hook) {
+    rotate_hook(rotated);
+  }
+
+  active = 0;
+  openFile();
+  openFrames();
+}
+
+void LogWriter::onRotate(std::function<void(const std::string &)> hook) {
+  rotate_hook = hook;
+}
+
+bool LogWriter::is_stdout() const { return file == STDOUT_FILENO; }
+
+LogWriter::~LogWriter() {
+  closeFile();
+
+  if (blocks[0] != nullptr) {
+    {
+      std::unique_lock<std::mutex> lock(flushlock);
+      stopping = true;
+      flushcv.notify_all();
+    }
+    flusher.join();
+    huge_free(blocks[0], block_size);
+    huge_free(blocks[1], block_size);
+  }
+}